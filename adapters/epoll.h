@@ -0,0 +1,418 @@
+#ifndef HIREDIS_EPOLL_H
+#define HIREDIS_EPOLL_H
+
+#include "hiredis/alloc.h"
+#include "hiredis/async.h"
+#include "hiredis/net.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A reactor for many async contexts on Linux.  Every context is registered
+ * once, edge-triggered for both directions, in an epoll set shared by the
+ * reactor, so starting and stopping reads and writes costs no system call.
+ * Readiness is remembered per context and used up by reading until the
+ * socket is drained and writing until it would block.  The timeouts of all
+ * contexts live in one min-heap.  redisEpollRunOnce() waits once and then
+ * handles every ready context. */
+
+/* Reads of one context per run before the others get their turn */
+[[maybe_unused]] static constexpr int REDIS_EPOLL_READ_BATCH = 64;
+
+/* Events fetched per epoll_wait() */
+[[maybe_unused]] static constexpr int REDIS_EPOLL_MAX_EVENTS = 256;
+
+typedef struct redisEpollEvents {
+  struct redisEpoll *loop;
+  redisAsyncContext *context;
+  redisFD fd;
+  bool reading;
+  bool writing;
+  /* Readiness reported by epoll and not used up yet */
+  bool readable;
+  bool writable;
+  bool hup;
+  bool queued;
+  bool deleted;
+  size_t heapidx; /* Position in the timer heap, SIZE_MAX when not armed */
+  double deadline;
+  struct redisEpollEvents *readynext;
+  struct redisEpollEvents *deletednext;
+} redisEpollEvents;
+
+typedef struct redisEpoll {
+  int epfd;
+  size_t contexts;
+  redisEpollEvents **heap;
+  size_t heaplen;
+  size_t heapcap;
+  redisEpollEvents *ready;   /* Contexts with readiness they want to use */
+  redisEpollEvents *deleted; /* Freed once they left the ready list */
+} redisEpoll;
+
+static double redisEpollGetNow() {
+#if defined(TIME_MONOTONIC)
+  constexpr double nanoseconds_per_second = 1'000'000'000.0;
+  struct timespec ts;
+  timespec_get(&ts, TIME_MONOTONIC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / nanoseconds_per_second;
+#elif defined(CLOCK_MONOTONIC)
+  constexpr double nanoseconds_per_second = 1'000'000'000.0;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / nanoseconds_per_second;
+#else
+  /* Strict ISO C before TIME_MONOTONIC has no monotonic clock */
+  constexpr double microseconds_per_second = 1'000'000.0;
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (double)tv.tv_sec + (double)tv.tv_usec / microseconds_per_second;
+#endif
+}
+
+static void redisEpollHeapSwap(redisEpoll *loop, size_t a, size_t b) {
+  auto e = loop->heap[a];
+  loop->heap[a] = loop->heap[b];
+  loop->heap[b] = e;
+  loop->heap[a]->heapidx = a;
+  loop->heap[b]->heapidx = b;
+}
+
+static void redisEpollHeapUp(redisEpoll *loop, size_t i) {
+  while (i > 0) {
+    auto parent = (i - 1) / 2;
+    if (loop->heap[parent]->deadline <= loop->heap[i]->deadline)
+      break;
+    redisEpollHeapSwap(loop, i, parent);
+    i = parent;
+  }
+}
+
+static void redisEpollHeapDown(redisEpoll *loop, size_t i) {
+  for (;;) {
+    auto left = 2 * i + 1;
+    auto min = i;
+    if (left < loop->heaplen && loop->heap[left]->deadline < loop->heap[min]->deadline)
+      min = left;
+    if (left + 1 < loop->heaplen && loop->heap[left + 1]->deadline < loop->heap[min]->deadline)
+      min = left + 1;
+    if (min == i)
+      break;
+    redisEpollHeapSwap(loop, i, min);
+    i = min;
+  }
+}
+
+static void redisEpollHeapRemove(redisEpoll *loop, redisEpollEvents *e) {
+  auto i = e->heapidx;
+  if (i == SIZE_MAX)
+    return;
+
+  e->heapidx = SIZE_MAX;
+  auto last = --loop->heaplen;
+  if (i != last) {
+    loop->heap[i] = loop->heap[last];
+    loop->heap[i]->heapidx = i;
+    redisEpollHeapDown(loop, i);
+    redisEpollHeapUp(loop, i);
+  }
+}
+
+/* Put a context on the ready list for the next run */
+static void redisEpollQueue(redisEpollEvents *e) {
+  if (e->queued || e->deleted)
+    return;
+  e->queued = true;
+  e->readynext = e->loop->ready;
+  e->loop->ready = e;
+}
+
+static void redisEpollAddRead(void *data) {
+  auto e = (redisEpollEvents *)data;
+  e->reading = true;
+  /* No new edge comes for data that already arrived */
+  if (e->readable)
+    redisEpollQueue(e);
+}
+
+static void redisEpollDelRead(void *data) {
+  auto e = (redisEpollEvents *)data;
+  e->reading = false;
+}
+
+static void redisEpollAddWrite(void *data) {
+  auto e = (redisEpollEvents *)data;
+  e->writing = true;
+  if (e->writable)
+    redisEpollQueue(e);
+}
+
+static void redisEpollDelWrite(void *data) {
+  auto e = (redisEpollEvents *)data;
+  e->writing = false;
+}
+
+static void redisEpollScheduleTimer(void *data, struct timeval tv) {
+  auto e = (redisEpollEvents *)data;
+  auto loop = e->loop;
+  constexpr double microseconds_per_second = 1'000'000.0;
+
+  e->deadline =
+      redisEpollGetNow() + (double)tv.tv_sec + (double)tv.tv_usec / microseconds_per_second;
+  if (e->heapidx == SIZE_MAX) {
+    /* Attaching reserved a slot for every context */
+    e->heapidx = loop->heaplen++;
+    loop->heap[e->heapidx] = e;
+  }
+  redisEpollHeapDown(loop, e->heapidx);
+  redisEpollHeapUp(loop, e->heapidx);
+}
+
+static void redisEpollCleanup(void *data) {
+  auto e = (redisEpollEvents *)data;
+  auto loop = e->loop;
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, e->fd, nullptr);
+  redisEpollHeapRemove(loop, e);
+  loop->contexts--;
+
+  /* The ready list may still point here, free it at the end of a run */
+  e->context = nullptr;
+  e->deleted = true;
+  e->deletednext = loop->deleted;
+  loop->deleted = e;
+}
+
+static void redisEpollUpdateFd(void *data) {
+  auto e = (redisEpollEvents *)data;
+
+  /* The old file left the set when it was closed, readiness starts over */
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = e};
+  e->readable = false;
+  e->writable = false;
+  e->hup = false;
+  if (epoll_ctl(e->loop->epfd, EPOLL_CTL_ADD, e->fd, &ev) == -1 && errno == EEXIST)
+    epoll_ctl(e->loop->epfd, EPOLL_CTL_MOD, e->fd, &ev);
+}
+
+/* Use up the readiness of one context, returns 1 when something was done */
+static int redisEpollDispatch(redisEpollEvents *e) {
+  auto ac = e->context;
+  auto c = &ac->c;
+  auto handled = 0;
+
+  if (e->readable && e->reading) {
+    handled = 1;
+    for (auto reads = 1;; reads++) {
+      redisAsyncHandleRead(ac);
+      if (e->deleted)
+        return handled;
+      if (!e->reading)
+        break;
+
+      /* Drained, unless the end of the stream is still to be read */
+      if ((c->flags & REDIS_READ_DRAINED) && !e->hup) {
+        e->readable = false;
+        break;
+      }
+      if (reads == REDIS_EPOLL_READ_BATCH) {
+        redisEpollQueue(e);
+        break;
+      }
+    }
+  }
+
+  if (e->writable && e->writing) {
+    handled = 1;
+    for (;;) {
+      auto before = redisOutputPending(c);
+      redisAsyncHandleWrite(ac);
+      if (e->deleted || !e->writing)
+        break;
+
+      auto after = redisOutputPending(c);
+      if (after == 0) {
+        /* Replies are still being freed lazily */
+        redisEpollQueue(e);
+        break;
+      } else if (after == before) {
+        /* The socket is full or still connecting, wait for the next edge */
+        e->writable = false;
+        break;
+      }
+    }
+  }
+
+  return handled;
+}
+
+/* Create a reactor, returns nullptr with errno set on failure */
+static redisEpoll *redisEpollCreate() {
+  auto loop = (redisEpoll *)hi_calloc(1, sizeof(redisEpoll));
+  if (loop == nullptr)
+    return nullptr;
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd == -1) {
+    hi_free(loop);
+    return nullptr;
+  }
+  return loop;
+}
+
+/* Free a reactor once all of its contexts were freed or disconnected */
+static void redisEpollFree(redisEpoll *loop) {
+  if (loop == nullptr)
+    return;
+
+  while (loop->deleted != nullptr) {
+    auto e = loop->deleted;
+    loop->deleted = e->deletednext;
+    hi_free(e);
+  }
+  close(loop->epfd);
+  hi_free(loop->heap);
+  hi_free(loop);
+}
+
+/* Wait for events up to timeout seconds, then handle every ready context and
+ * every expired timeout.  The timeout argument can be positive to wait for a
+ * maximum given time, zero to poll, or negative to wait forever.  Returns the
+ * number of contexts and timeouts handled, or -1 with errno set */
+static int redisEpollRunOnce(redisEpoll *loop, double timeout) {
+  struct epoll_event events[REDIS_EPOLL_MAX_EVENTS];
+  constexpr double milliseconds_per_second = 1'000.0;
+  constexpr double max_timeout = INT_MAX / 1'000;
+
+  /* Don't sleep with readiness left over, nor past the nearest timeout */
+  if (loop->ready != nullptr) {
+    timeout = 0.0;
+  } else if (loop->heaplen > 0) {
+    auto left = loop->heap[0]->deadline - redisEpollGetNow();
+    if (left < 0.0)
+      left = 0.0;
+    if (timeout < 0.0 || left < timeout)
+      timeout = left;
+  }
+
+  auto itimeout = -1;
+  if (timeout >= 0.0) {
+    if (timeout > max_timeout)
+      timeout = max_timeout;
+    /* Round up, waking before a deadline would only spin */
+    itimeout = (int)(timeout * milliseconds_per_second);
+    if ((double)itimeout < timeout * milliseconds_per_second)
+      itimeout++;
+  }
+
+  auto ns = epoll_wait(loop->epfd, events, REDIS_EPOLL_MAX_EVENTS, itimeout);
+  if (ns < 0) {
+    /* ignore the EINTR error */
+    if (errno != EINTR)
+      return ns;
+    ns = 0;
+  }
+
+  for (auto i = 0; i < ns; i++) {
+    auto e = (redisEpollEvents *)events[i].data.ptr;
+    auto ev = events[i].events;
+
+    if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      e->readable = true;
+    if (ev & (EPOLLRDHUP | EPOLLHUP))
+      e->hup = true;
+    /* Connection failure is indicated with an error event, handle it like
+     * writable. */
+    if (ev & (EPOLLOUT | EPOLLERR))
+      e->writable = true;
+    if ((e->readable && e->reading) || (e->writable && e->writing))
+      redisEpollQueue(e);
+  }
+
+  /* Contexts queued by the callbacks are handled on the next run */
+  auto handled = 0;
+  auto ready = loop->ready;
+  loop->ready = nullptr;
+  while (ready != nullptr) {
+    auto e = ready;
+    ready = e->readynext;
+    e->queued = false;
+    if (!e->deleted)
+      handled += redisEpollDispatch(e);
+  }
+
+  /* perform timeouts */
+  const double now = redisEpollGetNow();
+  while (loop->heaplen > 0 && loop->heap[0]->deadline <= now) {
+    auto e = loop->heap[0];
+    redisEpollHeapRemove(loop, e);
+    redisAsyncHandleTimeout(e->context);
+    handled++;
+  }
+
+  /* do the delayed cleanups */
+  for (auto prev = &loop->deleted; *prev != nullptr;) {
+    auto e = *prev;
+    if (e->queued) {
+      prev = &e->deletednext;
+    } else {
+      *prev = e->deletednext;
+      hi_free(e);
+    }
+  }
+
+  return handled;
+}
+
+static int redisEpollAttach(redisEpoll *loop, redisAsyncContext *ac) {
+  auto c = &ac->c;
+
+  /* Nothing should be attached when something is already attached */
+  if (ac->ev.data != nullptr)
+    return REDIS_ERR;
+
+  /* Reserve a timer slot for the context, scheduling can't fail later */
+  if (loop->contexts == loop->heapcap) {
+    auto cap = loop->heapcap ? loop->heapcap * 2 : 16;
+    auto heap = (redisEpollEvents **)hi_realloc(loop->heap, cap * sizeof(redisEpollEvents *));
+    if (heap == nullptr)
+      return REDIS_ERR;
+    loop->heap = heap;
+    loop->heapcap = cap;
+  }
+
+  /* Create container for context and r/w events */
+  auto e = (redisEpollEvents *)hi_calloc(1, sizeof(redisEpollEvents));
+  if (e == nullptr)
+    return REDIS_ERR;
+
+  e->loop = loop;
+  e->context = ac;
+  e->fd = c->fd;
+  e->heapidx = SIZE_MAX;
+
+  /* Registered once for both directions, readiness is tracked here */
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = e};
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+    hi_free(e);
+    return REDIS_ERR;
+  }
+  loop->contexts++;
+
+  /* Register functions to start/stop listening for events */
+  ac->ev.addRead = redisEpollAddRead;
+  ac->ev.delRead = redisEpollDelRead;
+  ac->ev.addWrite = redisEpollAddWrite;
+  ac->ev.delWrite = redisEpollDelWrite;
+  ac->ev.scheduleTimer = redisEpollScheduleTimer;
+  ac->ev.cleanup = redisEpollCleanup;
+  ac->ev.updateFd = redisEpollUpdateFd;
+  ac->ev.data = e;
+
+  return REDIS_OK;
+}
+#endif /* HIREDIS_EPOLL_H */
@@ -74,6 +74,16 @@ static void redisLibuvDelWrite(void *privdata) {
   }
 }
 
+static void redisLibuvUpdateFd(void *privdata) {
+  auto p = (redisLibuvEvents *)privdata;
+
+  /* libuv registered the old file, stopping forgets it */
+  uv_poll_stop(&p->handle);
+  if (p->events) {
+    uv_poll_start(&p->handle, p->events, redisLibuvPoll);
+  }
+}
+
 static void on_timer_close(uv_handle_t *handle) {
   auto p = (redisLibuvEvents *)handle->data;
   p->timer.data = nullptr;
@@ -148,6 +158,7 @@ static void redisLibuvCleanup(void *privdata) {
   ac->ev.delWrite = redisLibuvDelWrite;
   ac->ev.cleanup = redisLibuvCleanup;
   ac->ev.scheduleTimer = redisLibuvSetTimeout;
+  ac->ev.updateFd = redisLibuvUpdateFd;
 
   auto p = (redisLibuvEvents *)hi_calloc(1, sizeof(redisLibuvEvents));
   if (p == nullptr)
@@ -9,8 +9,10 @@ const base_sources = [_][]const u8{
 };
 
 const fmacros_sources = [_][]const u8{
+    "src/aof.c",
     "src/hiredis.c",
     "src/net.c",
+    "src/uring.c",
 };
 
 const common_cflags = [_][]const u8{
@@ -39,6 +41,7 @@ const common_cflags_pic = [_][]const u8{
 const posix_feature_cflags = [_][]const u8{
     "-D_XOPEN_SOURCE=600",
     "-D_POSIX_C_SOURCE=200112L",
+    "-D_DEFAULT_SOURCE",
 };
 
 const darwin_feature_cflags = [_][]const u8{
@@ -151,6 +154,62 @@ pub fn build(b: *std.Build) void {
         }
     }
 
+    {
+        const exe = addExample(
+            b,
+            "example-aof-stats",
+            "examples/example-aof-stats.c",
+            target,
+            optimize,
+            link_lib,
+            base_cflags,
+            false,
+            false,
+            true,
+        );
+        const install_exe = b.addInstallArtifact(exe, .{});
+        examples_step.dependOn(&install_exe.step);
+        if (enable_examples) {
+            b.getInstallStep().dependOn(&install_exe.step);
+        }
+    }
+
+    {
+        const exe = addExample(b, "example-format-bench", "examples/example-format-bench.c", target, optimize, link_lib, base_cflags, false, false, false);
+        const install_exe = b.addInstallArtifact(exe, .{});
+        examples_step.dependOn(&install_exe.step);
+        if (enable_examples) {
+            b.getInstallStep().dependOn(&install_exe.step);
+        }
+    }
+
+    {
+        const exe = addExample(b, "example-uring", "examples/example-uring.c", target, optimize, link_lib, base_cflags, false, false, false);
+        const install_exe = b.addInstallArtifact(exe, .{});
+        examples_step.dependOn(&install_exe.step);
+        if (enable_examples) {
+            b.getInstallStep().dependOn(&install_exe.step);
+        }
+    }
+
+    {
+        const exe = addExample(b, "example-pipeline", "examples/example-pipeline.c", target, optimize, link_lib, base_cflags, false, false, false);
+        const install_exe = b.addInstallArtifact(exe, .{});
+        examples_step.dependOn(&install_exe.step);
+        if (enable_examples) {
+            b.getInstallStep().dependOn(&install_exe.step);
+        }
+    }
+
+    if (os_tag == .linux) {
+        const exe = addExample(b, "example-epoll", "examples/example-epoll.c", target, optimize, link_lib, base_cflags, false, false, false);
+        const install_exe = b.addInstallArtifact(exe, .{});
+        examples_step.dependOn(&install_exe.step);
+        if (enable_examples) {
+            b.getInstallStep().dependOn(&install_exe.step);
+        }
+    }
+
     if (enable_ssl) {
         const exe = addExample(b, "example-ssl", "examples/example-ssl.c", target, optimize, link_lib, base_cflags, true, false, false);
         const install_exe = b.addInstallArtifact(exe, .{});
@@ -202,6 +261,10 @@ fn addHiredisLibrary(
 
     if (enable_ssl and shared) {
         lib.linkSystemLibrary("wolfssl");
+    }
+
+    // The REDIS_OPT_ASYNC_DNS resolver threads
+    if (shared and target.result.os.tag != .windows) {
         lib.linkSystemLibrary("pthread");
     }
 
@@ -0,0 +1,296 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "hiredis/aof.h"
+
+/* Scans an append-only file in parallel and prints per command statistics:
+ *
+ *   example-aof-stats appendonly.aof [threads]
+ *
+ * The file is split into one chunk per thread. Split offsets are moved to a
+ * command boundary before any thread starts, and once all threads are done
+ * every chunk is checked to have ended exactly where the next one starts. A
+ * split that landed inside a payload that looks like a command is detected
+ * there, and the rest of the file is rescanned sequentially. */
+
+constexpr int max_threads = 64;
+constexpr size_t name_slots = 256; /* Must be a power of two */
+constexpr size_t name_max = 32;
+constexpr int hll_bits = 12;
+constexpr size_t hll_registers = (size_t)1 << hll_bits;
+
+typedef struct {
+  char name[name_max];
+  size_t len;
+  uint64_t count;
+  uint64_t bytes;
+} command_stat_t;
+
+typedef struct {
+  const redisAof *aof;
+  size_t start;
+  size_t end;
+
+  /* Results */
+  size_t stopped; /* Offset the iterator stopped at */
+  int aligned;
+  int err;
+  char errstr[128];
+
+  uint64_t commands;
+  uint64_t keyed;
+  uint64_t key_bytes;
+  size_t key_max;
+  command_stat_t names[name_slots];
+  uint8_t hll[hll_registers];
+} chunk_t;
+
+static uint64_t hash_bytes(const char *p, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)p[i];
+    h *= 0x100000001b3ULL;
+  }
+  /* FNV alone mixes the high bits poorly, finish like murmur3 */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void hll_add(uint8_t *hll, const char *p, size_t len) {
+  auto h = hash_bytes(p, len);
+  auto index = (size_t)(h & (hll_registers - 1));
+  auto rest = h >> hll_bits;
+  uint8_t rank = 1;
+
+  while (rank <= 64 - hll_bits && (rest & 1) == 0) {
+    rank++;
+    rest >>= 1;
+  }
+  if (rank > hll[index])
+    hll[index] = rank;
+}
+
+static double hll_estimate(const uint8_t *hll) {
+  double sum = 0;
+  size_t zeros = 0;
+
+  for (size_t i = 0; i < hll_registers; i++) {
+    sum += ldexp(1.0, -hll[i]);
+    if (hll[i] == 0)
+      zeros++;
+  }
+
+  auto m = (double)hll_registers;
+  auto estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+  if (estimate <= 2.5 * m && zeros > 0)
+    estimate = m * log(m / (double)zeros);
+  return estimate;
+}
+
+static void count_command(chunk_t *chunk, const char *name, size_t len, uint64_t count,
+                          uint64_t bytes) {
+  char lower[name_max];
+
+  if (len >= name_max)
+    len = name_max - 1;
+  for (size_t i = 0; i < len; i++)
+    lower[i] = (char)tolower((unsigned char)name[i]);
+
+  auto slot = (size_t)hash_bytes(lower, len) & (name_slots - 1);
+  for (size_t probes = 0; probes < name_slots; probes++) {
+    auto stat = &chunk->names[slot];
+    if (stat->count == 0) {
+      memcpy(stat->name, lower, len);
+      stat->name[len] = '\0';
+      stat->len = len;
+    }
+    if (stat->len == len && memcmp(stat->name, lower, len) == 0) {
+      stat->count += count;
+      stat->bytes += bytes;
+      return;
+    }
+    slot = (slot + 1) & (name_slots - 1);
+  }
+}
+
+static void chunk_clear(chunk_t *chunk) {
+  chunk->err = 0;
+  chunk->errstr[0] = '\0';
+  chunk->commands = chunk->keyed = chunk->key_bytes = 0;
+  chunk->key_max = 0;
+  memset(chunk->names, 0, sizeof(chunk->names));
+  memset(chunk->hll, 0, sizeof(chunk->hll));
+}
+
+static int scan_chunk(void *arg) {
+  auto chunk = (chunk_t *)arg;
+  redisAofIterator it;
+  redisAofCommand *cmd;
+
+  chunk_clear(chunk);
+  redisAofIterInit(&it, chunk->aof, chunk->start, chunk->end);
+  while (redisAofNext(&it, &cmd) == REDIS_OK && cmd != nullptr) {
+    chunk->commands++;
+    count_command(chunk, cmd->argv[0], cmd->argvlen[0], 1, cmd->len);
+
+    if (cmd->argc > 1) {
+      chunk->keyed++;
+      chunk->key_bytes += cmd->argvlen[1];
+      if (cmd->argvlen[1] > chunk->key_max)
+        chunk->key_max = cmd->argvlen[1];
+      hll_add(chunk->hll, cmd->argv[1], cmd->argvlen[1]);
+    }
+  }
+
+  chunk->stopped = it.pos;
+  chunk->aligned = redisAofIterAligned(&it);
+  chunk->err = it.err;
+  memcpy(chunk->errstr, it.errstr, sizeof(chunk->errstr));
+  redisAofIterReset(&it);
+  return 0;
+}
+
+static void merge_chunk(chunk_t *total, const chunk_t *chunk) {
+  total->commands += chunk->commands;
+  total->keyed += chunk->keyed;
+  total->key_bytes += chunk->key_bytes;
+  if (chunk->key_max > total->key_max)
+    total->key_max = chunk->key_max;
+
+  for (size_t i = 0; i < hll_registers; i++) {
+    if (chunk->hll[i] > total->hll[i])
+      total->hll[i] = chunk->hll[i];
+  }
+
+  for (size_t i = 0; i < name_slots; i++) {
+    auto stat = &chunk->names[i];
+    if (stat->count > 0)
+      count_command(total, stat->name, stat->len, stat->count, stat->bytes);
+  }
+}
+
+static int compare_stats(const void *a, const void *b) {
+  auto sa = (const command_stat_t *)a;
+  auto sb = (const command_stat_t *)b;
+  if (sa->count != sb->count)
+    return sa->count < sb->count ? 1 : -1;
+  return strcmp(sa->name, sb->name);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <appendonly.aof> [threads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  constexpr int default_threads = 4;
+  auto nthreads = (argc > 2) ? atoi(argv[2]) : default_threads;
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > max_threads)
+    nthreads = max_threads;
+
+  auto aof = redisAofOpen(argv[1]);
+  if (aof == nullptr) {
+    fprintf(stderr, "Error: can't allocate aof reader\n");
+    return EXIT_FAILURE;
+  }
+  if (aof->err) {
+    fprintf(stderr, "Error: %s\n", aof->errstr);
+    redisAofClose(aof);
+    return EXIT_FAILURE;
+  }
+
+  chunk_t *chunks = calloc((size_t)nthreads + 1, sizeof(*chunks));
+  if (chunks == nullptr) {
+    fprintf(stderr, "Error: out of memory\n");
+    redisAofClose(aof);
+    return EXIT_FAILURE;
+  }
+  auto total = &chunks[nthreads];
+
+  /* All split points are decided before any thread runs. */
+  size_t prev = 0;
+  for (int i = 0; i < nthreads; i++) {
+    size_t nominal = aof->len / (size_t)nthreads * (size_t)(i + 1);
+    size_t split = (i == nthreads - 1) ? aof->len : redisAofSync(aof, nominal);
+    if (split < prev)
+      split = prev;
+    chunks[i].aof = aof;
+    chunks[i].start = prev;
+    chunks[i].end = split;
+    prev = split;
+  }
+
+  thrd_t threads[max_threads];
+  int started = 0;
+  for (; started < nthreads; started++) {
+    if (thrd_create(&threads[started], scan_chunk, &chunks[started]) != thrd_success) {
+      fprintf(stderr, "Failed to create thread %d, scanning the rest inline\n", started);
+      break;
+    }
+  }
+  for (int i = started; i < nthreads; i++)
+    scan_chunk(&chunks[i]);
+  for (int i = 0; i < started; i++)
+    thrd_join(threads[i], nullptr);
+
+  /* Validate the splits. A chunk that ran past its end did so by reading a
+   * real command across the split, so its own counts are right but the next
+   * chunk started inside a payload. Scan the rest of the file again from
+   * where the good chunk stopped and drop the chunks after it. */
+  int rescans = 0;
+  for (int i = 0; i + 1 < nthreads; i++) {
+    if (chunks[i].err)
+      break;
+    if (chunks[i].aligned)
+      continue;
+
+    chunks[i + 1].start = chunks[i].stopped;
+    chunks[i + 1].end = aof->len;
+    scan_chunk(&chunks[i + 1]);
+    for (int j = i + 2; j < nthreads; j++) {
+      chunks[j].start = chunks[j].end = aof->len;
+      chunk_clear(&chunks[j]);
+    }
+    rescans++;
+    break;
+  }
+
+  int rc = EXIT_SUCCESS;
+  for (int i = 0; i < nthreads; i++) {
+    if (chunks[i].err) {
+      fprintf(stderr, "Error: %s\n", chunks[i].errstr);
+      rc = EXIT_FAILURE;
+      break;
+    }
+    merge_chunk(total, &chunks[i]);
+  }
+
+  printf("file: %s (%zu bytes, %d threads, %d rescans)\n", argv[1], aof->len, nthreads, rescans);
+  printf("commands: %llu\n", (unsigned long long)total->commands);
+  printf("keyed commands: %llu, avg key %.1f bytes, max key %zu bytes\n",
+         (unsigned long long)total->keyed,
+         total->keyed ? (double)total->key_bytes / (double)total->keyed : 0.0, total->key_max);
+  printf("distinct keys (estimate): %.0f\n", total->keyed ? hll_estimate(total->hll) : 0.0);
+
+  qsort(total->names, name_slots, sizeof(total->names[0]), compare_stats);
+  printf("%-24s %12s %14s\n", "command", "count", "bytes");
+  for (size_t i = 0; i < name_slots && total->names[i].count > 0; i++) {
+    printf("%-24s %12llu %14llu\n", total->names[i].name,
+           (unsigned long long)total->names[i].count, (unsigned long long)total->names[i].bytes);
+  }
+
+  free(chunks);
+  redisAofClose(aof);
+  return rc;
+}
@@ -0,0 +1,69 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "adapters/epoll.h"
+#include "hiredis/async.h"
+
+/* Drives many async contexts from one epoll reactor:
+ *
+ *   example-epoll [connections]
+ *
+ * Every connection sets and gets its own key, then disconnects. */
+
+static int connections_left;
+
+static void getCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redisReply *reply = r;
+  if (reply == nullptr)
+    return;
+  if ((long)privdata == 0)
+    printf("GET key:0: %s\n", reply->str);
+  redisAsyncDisconnect(c);
+}
+
+static void disconnectCallback(const redisAsyncContext *c, int status) {
+  connections_left--;
+  if (status != REDIS_OK)
+    printf("Error: %s\n", c->errstr);
+}
+
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  constexpr int default_port = 6'379;
+  constexpr long default_connections = 100;
+  auto connections = (argc > 1) ? atol(argv[1]) : default_connections;
+  if (connections < 1)
+    connections = 1;
+
+  auto loop = redisEpollCreate();
+  if (loop == nullptr) {
+    printf("Error: can't create the epoll reactor\n");
+    return 1;
+  }
+
+  for (long i = 0; i < connections; i++) {
+    auto c = redisAsyncConnect("127.0.0.1", default_port);
+    if (c == nullptr || c->err || redisEpollAttach(loop, c) != REDIS_OK) {
+      printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+      if (c != nullptr)
+        redisAsyncFree(c);
+      break;
+    }
+    connections_left++;
+    redisAsyncSetDisconnectCallback(c, disconnectCallback);
+    redisAsyncCommand(c, nullptr, nullptr, "SET key:%ld %ld", i, i);
+    redisAsyncCommand(c, getCallback, (void *)i, "GET key:%ld", i);
+  }
+
+  constexpr double tick_seconds = 1.0;
+  while (connections_left > 0) {
+    if (redisEpollRunOnce(loop, tick_seconds) < 0) {
+      perror("epoll_wait");
+      break;
+    }
+  }
+  redisEpollFree(loop);
+  return 0;
+}
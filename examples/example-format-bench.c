@@ -0,0 +1,113 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hiredis/alloc.h"
+#include "hiredis/hiredis.h"
+
+/* Measures redisvFormatCommand(), which every printf style redisCommand() call
+ * goes through, with no server needed:
+ *
+ *   example-format-bench [iterations]
+ *
+ * For each format it prints the heap allocations (malloc, calloc and realloc
+ * calls through the hiredis allocator) and the time per formatted command. */
+
+static size_t allocations;
+
+static void *counting_malloc(size_t size) {
+  allocations++;
+  return malloc(size);
+}
+
+static void *counting_calloc(size_t nmemb, size_t size) {
+  allocations++;
+  return calloc(nmemb, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+  allocations++;
+  return realloc(ptr, size);
+}
+
+static char *counting_strdup(const char *str) {
+  allocations++;
+  return strdup(str);
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static char value[4'096];
+
+/* Format one command, returning its length. */
+static int format(int which) {
+  char *cmd = nullptr;
+  int len;
+
+  switch (which) {
+  case 0:
+    len = redisFormatCommand(&cmd, "PING");
+    break;
+  case 1:
+    len = redisFormatCommand(&cmd, "SET %s %s", "user:1000:session", "f3a9c2d1e8b7");
+    break;
+  case 2:
+    len = redisFormatCommand(&cmd, "HSET user:%d name %s visits %lld", 1'000, "alice", 42LL);
+    break;
+  case 3:
+    len = redisFormatCommand(&cmd, "ZADD leaderboard %f player:%u", 1234.5, 77U);
+    break;
+  case 4:
+    len = redisFormatCommand(&cmd, "SET blob:%d %b", 7, value, sizeof(value));
+    break;
+  default:
+    len = redisFormatCommand(&cmd, "MSET k1 %s k2 %s k3 %s k4 %s k5 %s k6 %s", "v1", "v2", "v3",
+                             "v4", "v5", "v6");
+    break;
+  }
+  redisFreeCommand(cmd);
+  return len;
+}
+
+int main(int argc, char **argv) {
+  static const char *names[] = {"PING",       "SET %s %s",       "HSET %d %s %lld",
+                                 "ZADD %f %u", "SET %d %b (4KB)", "MSET 6 pairs"};
+  constexpr int formats = sizeof(names) / sizeof(names[0]);
+  auto iterations = (argc > 1) ? atol(argv[1]) : 1'000'000L;
+  if (iterations < 1)
+    iterations = 1;
+
+  memset(value, 'x', sizeof(value));
+
+  hiredisAllocFuncs counting = {
+      .mallocFn = counting_malloc,
+      .callocFn = counting_calloc,
+      .reallocFn = counting_realloc,
+      .strdupFn = counting_strdup,
+      .freeFn = free,
+  };
+  hiredisSetAllocators(&counting);
+
+  printf("%-20s %10s %12s %10s\n", "format", "bytes", "allocs/call", "ns/call");
+  for (int i = 0; i < formats; i++) {
+    allocations = 0;
+    auto len = format(i);
+    auto per_call = allocations;
+
+    auto start = now_ns();
+    for (long n = 0; n < iterations; n++)
+      format(i);
+    auto elapsed = now_ns() - start;
+
+    printf("%-20s %10d %12zu %10.1f\n", names[i], len, per_call, elapsed / (double)iterations);
+  }
+
+  hiredisResetAllocators();
+  return EXIT_SUCCESS;
+}
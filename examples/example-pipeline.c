@@ -0,0 +1,75 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hiredis/hiredis.h"
+
+/* Pipelines SET commands of 1KB values with redisPipeline(), keeping at most
+ * a megabyte of them in flight:
+ *
+ *   example-pipeline [commands] */
+
+typedef struct pipelineState {
+  long next;
+  long total;
+  long ok;
+  char value[1'024];
+} pipelineState;
+
+static int feed(redisContext *c, void *privdata) {
+  pipelineState *s = privdata;
+  constexpr long batch = 64;
+
+  int n = 0;
+  for (; n < batch && s->next < s->total; n++, s->next++) {
+    if (redisAppendCommand(c, "SET key:%ld %b", s->next, s->value, sizeof(s->value)) != REDIS_OK)
+      return REDIS_ERR;
+  }
+  return n;
+}
+
+static void onReply([[maybe_unused]] redisContext *c, void *r, void *privdata) {
+  pipelineState *s = privdata;
+  redisReply *reply = r;
+  if (reply->type == REDIS_REPLY_STATUS)
+    s->ok++;
+  freeReplyObject(reply);
+}
+
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  constexpr int default_port = 6'379;
+  constexpr long default_commands = 1'000'000;
+  constexpr size_t max_inflight = 1'024 * 1'024;
+
+  static pipelineState s;
+  s.total = (argc > 1) ? atol(argv[1]) : default_commands;
+  for (size_t i = 0; i < sizeof(s.value); i++)
+    s.value[i] = (char)('a' + i % 26);
+
+  auto c = redisConnect("127.0.0.1", default_port);
+  if (c == nullptr || c->err) {
+    printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+    redisFree(c);
+    return 1;
+  }
+
+  struct timespec start, end;
+  timespec_get(&start, TIME_UTC);
+  if (redisPipeline(c, feed, onReply, &s, max_inflight) != REDIS_OK) {
+    printf("Error: %s\n", c->errstr);
+    redisFree(c);
+    return 1;
+  }
+  timespec_get(&end, TIME_UTC);
+
+  constexpr double nanoseconds_per_second = 1e9;
+  auto seconds = (double)(end.tv_sec - start.tv_sec) +
+                 (double)(end.tv_nsec - start.tv_nsec) / nanoseconds_per_second;
+  printf("%ld of %ld SETs ok in %.3fs (%.0f/s)\n", s.ok, s.total, seconds,
+         seconds > 0 ? (double)s.total / seconds : 0.0);
+  redisFree(c);
+  return 0;
+}
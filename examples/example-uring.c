@@ -0,0 +1,97 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "adapters/poll.h"
+#include "hiredis/async.h"
+#include "hiredis/hiredis_uring.h"
+
+/* Runs a GET on a blocking and on an async context over io_uring, falling
+ * back to plain sockets and the poll adapter where io_uring is unavailable:
+ *
+ *   example-uring [value] */
+
+static bool exit_loop = false;
+
+static void getCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redisReply *reply = r;
+  if (reply == nullptr)
+    return;
+  printf("async %s: %s\n", (char *)privdata, reply->str);
+  redisAsyncDisconnect(c);
+}
+
+static void disconnectCallback(const redisAsyncContext *c, int status) {
+  exit_loop = true;
+  if (status != REDIS_OK)
+    printf("Error: %s\n", c->errstr);
+}
+
+static int blocking(const char *value) {
+  constexpr int default_port = 6'379;
+  auto c = redisConnect("127.0.0.1", default_port);
+  if (c == nullptr || c->err) {
+    printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+    redisFree(c);
+    return 1;
+  }
+  if (redisInitiateUring(c) != REDIS_OK)
+    printf("io_uring unavailable, using plain sockets\n");
+
+  redisReply *reply = redisCommand(c, "SET key %s", value);
+  if (reply != nullptr) {
+    freeReplyObject(reply);
+    reply = redisCommand(c, "GET key");
+  }
+  if (reply == nullptr) {
+    printf("Error: %s\n", c->errstr);
+    redisFree(c);
+    return 1;
+  }
+  printf("blocking GET key: %s\n", reply->str);
+  freeReplyObject(reply);
+  redisFree(c);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  const char *value = (argc > 1) ? argv[1] : "uring-example-value";
+  if (blocking(value) != 0)
+    return 1;
+
+  constexpr int default_port = 6'379;
+  auto c = redisAsyncConnect("127.0.0.1", default_port);
+  if (c == nullptr || c->err) {
+    printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+    if (c != nullptr)
+      redisAsyncFree(c);
+    return 1;
+  }
+
+  constexpr unsigned ring_entries = 64;
+  auto ring = redisUringCreate(ring_entries);
+  if (ring == nullptr || redisUringAttach(c, ring) != REDIS_OK) {
+    printf("io_uring unavailable, using the poll adapter\n");
+    redisUringFree(ring);
+    ring = nullptr;
+    redisPollAttach(c);
+  }
+
+  redisAsyncSetDisconnectCallback(c, disconnectCallback);
+  if (redisAsyncCommand(c, getCallback, (char *)"GET key", "GET key") != REDIS_OK) {
+    printf("Error: %s\n", c->errstr);
+    redisAsyncDisconnect(c);
+  }
+
+  constexpr double tick_seconds = 0.1;
+  while (!exit_loop) {
+    if (ring != nullptr)
+      redisUringTick(ring, tick_seconds);
+    else
+      redisPollTick(c, tick_seconds);
+  }
+  redisUringFree(ring);
+  return 0;
+}
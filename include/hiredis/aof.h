@@ -0,0 +1,73 @@
+#ifndef __HIREDIS_AOF_H
+#define __HIREDIS_AOF_H
+
+#include <stddef.h> /* for size_t */
+
+#include "hiredis/read.h"
+
+/* Reader for append-only files (or any file holding RESP multi-bulk commands)
+ * that parses straight out of a read-only mapping of the file. Commands are
+ * returned as argv views pointing into the mapping, so nothing is copied and
+ * the views are only valid while the redisAof is open.
+ *
+ * A file can be split into chunks that are scanned concurrently: pick nominal
+ * split offsets, move each one to a command boundary with redisAofSync() and
+ * run one iterator per [start, end) range. redisAofSync() can be fooled by
+ * payloads that themselves look like RESP commands, so after the chunks are
+ * scanned the caller has to check that every iterator stopped exactly at the
+ * start of the next chunk (redisAofIterAligned) and rescan the ones that
+ * did not. Iterators never write to the redisAof and may run in parallel. */
+
+/* Number of commands redisAofSync() must parse after a candidate offset
+ * before it is accepted as a command boundary. */
+[[maybe_unused]] static constexpr int REDIS_AOF_SYNC_COMMANDS = 4;
+
+typedef struct redisAof {
+  int err;          /* Error flags, 0 when there is no error */
+  char errstr[128]; /* String representation of error when applicable */
+
+  const char *buf; /* Mapped file contents */
+  size_t len;      /* File length */
+} redisAof;
+
+/* A single command. argv[i] is not null terminated, use argvlen[i]. */
+typedef struct redisAofCommand {
+  size_t offset; /* Offset of the command in the file */
+  size_t len;    /* Encoded length of the command */
+  int argc;
+  const char **argv;
+  size_t *argvlen;
+} redisAofCommand;
+
+typedef struct redisAofIterator {
+  int err;          /* Error flags, 0 when there is no error */
+  char errstr[128]; /* String representation of error when applicable */
+
+  const redisAof *aof;
+  size_t pos; /* Offset of the next command */
+  size_t end; /* Commands starting at or after this offset are not returned */
+
+  redisAofCommand cmd; /* Last command returned by redisAofNext() */
+  int argvcap;
+} redisAofIterator;
+
+[[nodiscard]] redisAof *redisAofOpen(const char *path);
+void redisAofClose(redisAof *aof);
+
+/* Return the offset of the first command boundary at or after offset, or
+ * aof->len when there is none. */
+size_t redisAofSync(const redisAof *aof, size_t offset);
+
+void redisAofIterInit(redisAofIterator *it, const redisAof *aof, size_t start, size_t end);
+void redisAofIterReset(redisAofIterator *it);
+
+/* Parse the next command. Returns REDIS_OK and sets *cmd to the command, or
+ * to nullptr once the end of the range was reached. Returns REDIS_ERR on a
+ * malformed or truncated file, with the error set in the iterator. */
+int redisAofNext(redisAofIterator *it, redisAofCommand **cmd);
+
+/* True when an iterator that ran to the end of its range stopped exactly on
+ * its end offset, i.e. the next chunk was split on a real command boundary. */
+#define redisAofIterAligned(_it) ((_it)->err == 0 && (_it)->pos == (_it)->end)
+
+#endif
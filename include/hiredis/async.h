@@ -36,6 +36,7 @@
 
 struct redisAsyncContext; /* need forward declaration of redisAsyncContext */
 struct dict;              /* dictionary header is included in async.c */
+struct redisLazyFreeFrame;
 
 /* Reply callback prototype and container */
 typedef void(redisCallbackFn)(struct redisAsyncContext *, void *, void *);
@@ -45,6 +46,8 @@ typedef struct redisCallback {
   int pending_subs;
   int unsubscribe_sent;
   void *privdata;
+  bool tofd; /* The reply payload goes to fd, see redisAsyncGetToFd() */
+  int fd;
 } redisCallback;
 
 /* List of callbacks for either regular replies or pub/sub */
@@ -83,6 +86,13 @@ typedef struct redisAsyncContext {
     void (*delWrite)(void *privdata);
     void (*cleanup)(void *privdata);
     void (*scheduleTimer)(void *privdata, struct timeval tv);
+
+    /* Called when the file behind c.fd was replaced, keeping the descriptor
+     * number: a REDIS_OPT_ASYNC_DNS context moves from the stand-in used
+     * during the host name lookup to its socket. Event libraries that
+     * registered the file rather than the number must register it again,
+     * the others can leave this unset. */
+    void (*updateFd)(void *privdata);
   } ev;
 
   /* Called when either the connection is terminated due to an error or per
@@ -110,6 +120,15 @@ typedef struct redisAsyncContext {
 
   /* Any configured RESP3 PUSH handler */
   redisAsyncPushFn *push_cb;
+
+  /* Large replies being freed incrementally, see redisAsyncSetLazyFree() */
+  struct {
+    size_t threshold; /* 0 when disabled */
+    size_t budget;    /* Reply objects freed per event loop tick */
+    struct redisLazyFreeFrame *stack;
+    size_t depth;
+    size_t cap;
+  } lazyfree;
 } redisAsyncContext;
 
 /* Functions that proxy to hiredis */
@@ -126,6 +145,25 @@ int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallba
 
 redisAsyncPushFn *redisAsyncSetPushCallback(redisAsyncContext *ac, redisAsyncPushFn *fn);
 int redisAsyncSetTimeout(redisAsyncContext *ac, struct timeval tv);
+
+/* Commands issued between redisAsyncCork() and redisAsyncUncork() only fill
+ * the output buffer: the write event is requested once, at uncork, instead of
+ * once per command. With REDIS_OPT_TCP_CORK the socket is corked as well
+ * (TCP_CORK or TCP_NOPUSH), so the batch leaves in full sized segments. */
+void redisAsyncCork(redisAsyncContext *ac);
+void redisAsyncUncork(redisAsyncContext *ac);
+
+/* Free replies whose top level aggregate has at least threshold elements in
+ * slices of at most budget reply objects per event loop tick, instead of
+ * walking the whole tree right after the callback returns. A threshold of 0
+ * disables lazy freeing, a budget of 0 selects REDIS_LAZYFREE_BUDGET. Only
+ * available with the default reply object functions. */
+[[maybe_unused]] static constexpr size_t REDIS_LAZYFREE_BUDGET = 4'096;
+int redisAsyncSetLazyFree(redisAsyncContext *ac, size_t threshold, size_t budget);
+
+/* Free a reply owned by the caller (REDIS_OPT_NOAUTOFREEREPLIES) the same way
+ * the library frees replies, so large ones are freed incrementally. */
+void redisAsyncFreeReply(redisAsyncContext *ac, void *reply);
 void redisAsyncDisconnect(redisAsyncContext *ac);
 void redisAsyncFree(redisAsyncContext *ac);
 
@@ -137,14 +175,42 @@ void redisAsyncRead(redisAsyncContext *ac);
 void redisAsyncWrite(redisAsyncContext *ac);
 
 /* Command functions for an async context. Write the command to the
- * output buffer and register the provided callback. */
+ * output buffer and register the provided callback. The reply mode set with
+ * CLIENT REPLY is tracked: after OFF, and for the one command after SKIP, the
+ * server sends no reply and the callback is dropped without being called. */
 int redisvAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
                        const char *format, va_list ap);
 int redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
                       const char *format, ...);
 int redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc,
                           const char **argv, const size_t *argvlen);
+int redisAsyncCommandArgs(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc,
+                          const redisArg *args);
 int redisAsyncFormattedCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
                                const char *cmd, size_t len);
+int redisvAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                               const redisCommandTemplate *t, va_list ap);
+int redisAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                              const redisCommandTemplate *t, ...);
+
+/* Register the command built on ac->c with redisCommandBegin() and the
+ * redisCommandAdd*() functions, in place of redisCommandFinish(). */
+int redisAsyncCommandFinish(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata);
+
+/* Borrowing variant of redisAsyncCommandArgv(), see
+ * redisAppendCommandArgvBorrowed(). written is called with wprivdata once the
+ * large arguments may be reused. A command that was written gets its written
+ * callback before its reply callback. */
+int redisAsyncCommandArgvBorrowed(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                                  int argc, const char **argv, const size_t *argvlen,
+                                  redisWrittenFn *written, void *wprivdata);
+
+/* Async variant of redisGetToFd(): the value of key is written to fd as it
+ * arrives and fn gets the integer, nil, error or "FDERR" reply redisGetToFd()
+ * would return. fd must stay open until then. A non-blocking fd is never
+ * waited for: while it is full the payload waits in a pipe of the context
+ * and is retried on the next read or write event. */
+int redisAsyncGetToFd(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *key,
+                      size_t keylen, int fd);
 
 #endif
@@ -56,6 +56,11 @@
     if ((ctx)->ev.delWrite)                                                                        \
       (ctx)->ev.delWrite((ctx)->ev.data);                                                          \
   } while (0)
+#define _EL_UPDATE_FD(ctx)                                                                         \
+  do {                                                                                             \
+    if ((ctx)->ev.updateFd)                                                                        \
+      (ctx)->ev.updateFd((ctx)->ev.data);                                                          \
+  } while (0)
 #define _EL_CLEANUP(ctx)                                                                           \
   do {                                                                                             \
     if ((ctx)->ev.cleanup)                                                                         \
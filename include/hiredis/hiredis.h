@@ -35,6 +35,7 @@
 #define __HIREDIS_H
 
 #include <stdarg.h>    /* for va_list */
+#include <stdatomic.h> /* for atomic_uint */
 #include <stdint.h>    /* uintXX_t, etc */
 #include <sys/time.h>  /* for struct timeval */
 #include <sys/types.h> /* for ssize_t */
@@ -95,12 +96,45 @@
 [[maybe_unused]] static constexpr int REDIS_PREFER_IPV4 = 0b1000'0000'0000;
 [[maybe_unused]] static constexpr int REDIS_PREFER_IPV6 = 0b0001'0000'0000'0000;
 
+/* Flag that is set while an async context is corked, see redisAsyncCork(),
+ * and when the socket is to be corked along with it. */
+[[maybe_unused]] static constexpr int REDIS_CORKED = 0b0010'0000'0000'0000;
+[[maybe_unused]] static constexpr int REDIS_TCP_CORK = 0b0100'0000'0000'0000;
+
+/* Flags for REDIS_OPT_INLINE_WRITE: commands try to write right away, until a
+ * write left output behind for the event loop to finish. */
+[[maybe_unused]] static constexpr int REDIS_INLINE_WRITE = 0b1000'0000'0000'0000;
+[[maybe_unused]] static constexpr int REDIS_WRITE_WAIT = 0b0001'0000'0000'0000'0000;
+
+/* Reply mode of an async context as set with CLIENT REPLY: no replies at all
+ * after OFF, none for the next command after SKIP. Commands sent meanwhile
+ * register no reply callback, their callbacks are never called. */
+[[maybe_unused]] static constexpr int REDIS_NO_REPLIES = 0b0010'0000'0000'0000'0000;
+[[maybe_unused]] static constexpr int REDIS_SKIP_REPLY = 0b0100'0000'0000'0000'0000;
+
+/* Flag for REDIS_OPT_ASYNC_DNS: host names of a nonblocking connection are
+ * looked up by a resolver thread. */
+[[maybe_unused]] static constexpr int REDIS_ASYNC_DNS = 0b1000'0000'0000'0000'0000;
+
+/* Flag for REDIS_OPT_SHARED_DNS_CACHE: host name lookups go through the
+ * process-wide address cache. */
+[[maybe_unused]] static constexpr int REDIS_SHARED_DNS_CACHE = 0b0001'0000'0000'0000'0000'0000;
+
+/* Flag that is set when the last redisBufferRead() found the socket drained:
+ * the read would have blocked, or a plain socket returned less than asked
+ * for. Edge-triggered event loops can stop reading without probing it. */
+[[maybe_unused]] static constexpr int REDIS_READ_DRAINED = 0b0010'0000'0000'0000'0000'0000;
+
 [[maybe_unused]] static constexpr int REDIS_KEEPALIVE_INTERVAL = 15; /* seconds */
 
 /* number of times we retry to connect in the case of EADDRNOTAVAIL and
  * SO_REUSEADDR is being used. */
 [[maybe_unused]] static constexpr int REDIS_CONNECT_RETRIES = 10;
 
+/* Milliseconds a blocking connect waits for the attempts in flight before it
+ * races the next address too, the Connection Attempt Delay of RFC 8305. */
+[[maybe_unused]] static constexpr int REDIS_CONNECT_ATTEMPT_DELAY = 250;
+
 /* Forward declarations for structs defined elsewhere */
 struct redisAsyncContext;
 struct redisContext;
@@ -110,6 +144,18 @@ struct redisContext;
 typedef void(redisPushFn)(void *, void *);
 typedef void(redisAsyncPushFn)(struct redisAsyncContext *, void *);
 
+/* Called with REDIS_OK once a command appended with borrowed arguments was
+ * written to the socket, or with REDIS_ERR when it was dropped unsent
+ * because the context is freed or reconnected. */
+typedef void(redisWrittenFn)(void *privdata, int status);
+
+/* redisReply.flags: str is an anonymous mapping (see redisReader.mmapthreshold),
+ * backed by 2MB huge pages when HUGETLB is also set, or an over-aligned heap
+ * allocation (see redisReader.stralign). */
+[[maybe_unused]] static constexpr int REDIS_REPLY_STR_MMAP = 0b001;
+[[maybe_unused]] static constexpr int REDIS_REPLY_STR_HUGETLB = 0b010;
+[[maybe_unused]] static constexpr int REDIS_REPLY_STR_ALIGNED = 0b100;
+
 /* This is the reply object returned by redisCommand() */
 typedef struct redisReply {
   int type;                    /* REDIS_REPLY_* */
@@ -123,13 +169,25 @@ typedef struct redisReply {
                                   terminated 3 character content type, such as "txt". */
   size_t elements;             /* number of elements, for REDIS_REPLY_ARRAY */
   struct redisReply **element; /* elements vector for REDIS_REPLY_ARRAY */
+  atomic_uint refs;            /* References besides the owner's, see redisReplyRetain() */
+  int flags;                   /* REDIS_REPLY_STR_* storage of str */
 } redisReply;
 
 [[nodiscard]] redisReader *redisReaderCreate();
 
-/* Function to free the reply objects hiredis returns by default. */
+/* Function to free the reply objects hiredis returns by default. When the
+ * reply was retained this only drops a reference. */
 void freeReplyObject(void *reply);
 
+/* Share a reply between several owners without copying it. Every retain must
+ * be paired with a release (or freeReplyObject(), which is the same thing);
+ * the last one frees the reply. Both are safe to call from different threads.
+ * Elements of an aggregate can be retained on their own and then outlive
+ * their parent. In async callbacks retaining the reply keeps it alive after
+ * the library drops its own reference, without REDIS_OPT_NOAUTOFREEREPLIES. */
+redisReply *redisReplyRetain(redisReply *reply);
+void redisReplyRelease(redisReply *reply);
+
 /* Functions to format a command according to the protocol. */
 int redisvFormatCommand(char **target, const char *format, va_list ap);
 int redisFormatCommand(char **target, const char *format, ...);
@@ -139,9 +197,48 @@ long long redisFormatSdsCommandArgv(sds *target, int argc, const char **argv,
 void redisFreeCommand(char *cmd);
 void redisFreeSdsCommand(sds cmd);
 
+/* A format that is used over and over can be compiled once into a template,
+ * which splits it into arguments and keeps the constant ones fully encoded.
+ * Templates take the same formats and values as redisFormatCommand(), but an
+ * unsupported conversion is reported when the template is created (nullptr
+ * is returned for it as well as when out of memory). A template is never
+ * modified after it was created and can be shared between threads. */
+typedef struct redisCommandTemplate redisCommandTemplate;
+
+[[nodiscard]] redisCommandTemplate *redisCreateCommandTemplate(const char *format);
+void redisFreeCommandTemplate(redisCommandTemplate *t);
+
+/* Typed command arguments. Arrays of floats are sent as the little endian
+ * binary blobs that vector commands (FT.SEARCH, HSET of a FLOAT32 field,
+ * VADD ... FP32) expect, copied once into the command with no formatting.
+ *
+ * A REDIS_ARG_FILE argument is count bytes of the file fd starting at offset.
+ * It is never loaded into memory: a plain TCP connection sends it with
+ * sendfile() where available, otherwise (and over TLS) it is read and sent
+ * in chunks. The file has to stay open and unchanged until the command was
+ * written. File arguments can only be appended to a context, not formatted
+ * into a standalone command. */
+[[maybe_unused]] static constexpr int REDIS_ARG_BUFFER = 0;
+[[maybe_unused]] static constexpr int REDIS_ARG_FLOAT32 = 1;
+[[maybe_unused]] static constexpr int REDIS_ARG_FLOAT64 = 2;
+[[maybe_unused]] static constexpr int REDIS_ARG_FILE = 3;
+
+typedef struct redisArg {
+  int type;         /* REDIS_ARG_* */
+  const void *data; /* Bytes, or an array of float / double */
+  size_t count;     /* Bytes for REDIS_ARG_BUFFER and REDIS_ARG_FILE, array elements otherwise */
+  int fd;           /* REDIS_ARG_FILE only */
+  long long offset; /* REDIS_ARG_FILE only */
+} redisArg;
+
+long long redisFormatSdsCommandArgs(sds *target, int argc, const redisArg *args);
+
 enum redisConnectionType { REDIS_CONN_TCP, REDIS_CONN_UNIX, REDIS_CONN_USERFD };
 
 struct redisSsl;
+struct redisOutRef;  /* Defined in net.h */
+struct redisResolve; /* Defined in net.c */
+struct redisAddrs;   /* Defined in net.c */
 
 [[maybe_unused]] static constexpr int REDIS_OPT_NONBLOCK = 0b0000'0001;
 [[maybe_unused]] static constexpr int REDIS_OPT_REUSEADDR = 0b0000'0010;
@@ -164,6 +261,23 @@ struct redisSsl;
     REDIS_OPT_PREFER_IPV4 | REDIS_OPT_PREFER_IPV6;
 [[maybe_unused]] static constexpr int REDIS_OPT_SET_SOCK_CLOEXEC =
     0b1000'0000; /* Set SOCK_CLOEXEC on socket file descriptor. */
+[[maybe_unused]] static constexpr int REDIS_OPT_TCP_CORK =
+    0b0001'0000'0000; /* Cork the socket too in redisAsyncCork(). */
+[[maybe_unused]] static constexpr int REDIS_OPT_INLINE_WRITE =
+    0b0010'0000'0000; /* Async commands are written from the command call
+                       * when nothing is waiting for the event loop, which
+                       * is only asked to write what did not fit. Write
+                       * errors are reported from the next write event. */
+[[maybe_unused]] static constexpr int REDIS_OPT_ASYNC_DNS =
+    0b0100'0000'0000; /* Async connects look up host names on a resolver
+                       * thread instead of blocking in getaddrinfo(), the
+                       * connect timeout covers the lookup too. Blocking
+                       * contexts and numeric addresses are not affected. */
+[[maybe_unused]] static constexpr int REDIS_OPT_SHARED_DNS_CACHE =
+    0b1000'0000'0000; /* Share looked up addresses between all contexts of
+                       * the process, so new connections to a known host
+                       * skip getaddrinfo(). They are looked up again once
+                       * a connect through them failed. */
 
 /* In Unix systems a file descriptor is a regular signed int, with -1
  * representing an invalid descriptor. */
@@ -254,6 +368,56 @@ typedef struct redisContext {
   char *obuf;          /* Write buffer */
   redisReader *reader; /* Protocol reader */
 
+  /* Output queue state. obuf holds the protocol bytes, large arguments are
+   * queued by reference in between them and sent with the same syscall. */
+  struct {
+    size_t pos;                      /* Bytes of obuf already written */
+    struct redisOutRef *head, *tail; /* Referenced buffers, in output order */
+    size_t reflen;                   /* Unsent bytes in referenced buffers */
+    size_t hiwat;                    /* Decaying peak of obuf, to size it when drained */
+  } out;
+
+  /* MSG_ZEROCOPY sends, see redisEnableZeroCopy() */
+  struct {
+    size_t threshold;                /* Smallest ref sent zerocopy, 0 when disabled */
+    uint32_t next;                   /* Sequence number of the next zerocopy send */
+    uint32_t completed;              /* Sends the kernel reported as completed */
+    struct redisOutRef *head, *tail; /* Written refs held until their sends complete */
+    uint64_t sends;                  /* Zerocopy sendmsg() calls */
+    uint64_t copied;                 /* Zerocopy sends the kernel copied after all */
+    uint64_t fallbacks;              /* Plain sends while enabled */
+  } zerocopy;
+
+  /* Spinning receives, see redisEnableBusyPoll() */
+  struct {
+    unsigned int usec;  /* Spin before a receive blocks, 0 when disabled */
+    bool sockopt;       /* SO_BUSY_POLL is set on the socket */
+    uint64_t hits;      /* Receives that got data while spinning */
+    uint64_t fallbacks; /* Receives that spun out and blocked */
+  } busypoll;
+
+  /* Command being built, see redisCommandBegin() */
+  struct {
+    size_t mark; /* Length of obuf before the command */
+    int argc;    /* Announced arguments, 0 when no command is being built */
+    int added;   /* Arguments added so far */
+  } build;
+
+  /* GET payload being moved to a descriptor, see redisGetToFd() */
+  struct {
+    bool active;   /* The bulk header was parsed, the payload is being moved */
+    int fd;        /* Descriptor the payload goes to */
+    int err;       /* errno of a failed write to fd, 0 when none failed */
+    long long len; /* Payload length */
+    size_t left;   /* Payload bytes not yet taken from the connection */
+    int splice;    /* 1 once fd took a splice, -1 when it can't, 0 before */
+    /* Payload bytes fd did not take yet wait in this pipe, which is created
+     * on first use and kept until the context is freed */
+    int pipe[2];
+    size_t pipecap;
+    size_t inpipe;
+  } tofd;
+
   enum redisConnectionType connection_type;
   struct timeval *connect_timeout;
   struct timeval *command_timeout;
@@ -272,6 +436,13 @@ typedef struct redisContext {
   struct sockaddr *saddr;
   size_t addrlen;
 
+  /* Host name lookup in progress, see REDIS_OPT_ASYNC_DNS */
+  struct redisResolve *resolve;
+
+  /* Addresses tcp.host resolved to, reused by redisReconnect() until a
+   * connect through them fails */
+  struct redisAddrs *addrs;
+
   /* Optional data and corresponding destructor users can use to provide
    * context to a given redisContext.  Not used by hiredis. */
   void *privdata;
@@ -315,6 +486,22 @@ int redisSetTimeout(redisContext *c, const struct timeval tv);
 int redisEnableKeepAlive(redisContext *c);
 int redisEnableKeepAliveWithInterval(redisContext *c, int interval);
 int redisSetTcpUserTimeout(redisContext *c, unsigned int timeout);
+
+/* Send queued arguments of at least threshold bytes with MSG_ZEROCOPY
+ * (Linux, TCP only); 0 turns it off. Such a buffer is released, or its
+ * written callback called, only once the kernel reported the send complete.
+ * Returns REDIS_ERR, leaving the context as it was, when the socket does not
+ * support it. */
+int redisEnableZeroCopy(redisContext *c, size_t threshold);
+
+/* Have receives of a blocking context spin on the socket for up to usec
+ * microseconds before they block, saving the scheduler wakeup per reply at
+ * the cost of a busy core; 0 turns it off. With sockopt, SO_BUSY_POLL has
+ * the kernel poll the device queue meanwhile too (Linux, raising it usually
+ * takes CAP_NET_ADMIN). Plain sockets only, see c->busypoll for the counters.
+ * Returns REDIS_ERR, leaving the context as it was, when SO_BUSY_POLL is
+ * refused. */
+int redisEnableBusyPoll(redisContext *c, unsigned int usec, bool sockopt);
 void redisFree(redisContext *c);
 redisFD redisFreeKeepFd(redisContext *c);
 int redisBufferRead(redisContext *c);
@@ -336,6 +523,30 @@ int redisAppendFormattedCommand(redisContext *c, const char *cmd, size_t len);
 int redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 int redisAppendCommand(redisContext *c, const char *format, ...);
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+int redisAppendCommandArgs(redisContext *c, int argc, const redisArg *args);
+int redisvAppendTemplate(redisContext *c, const redisCommandTemplate *t, va_list ap);
+int redisAppendTemplate(redisContext *c, const redisCommandTemplate *t, ...);
+
+/* Like redisAppendCommandArgv(), but arguments of REDIS_OUTREF_MIN bytes or
+ * more are not copied: they are written to the socket straight from argv,
+ * which has to stay valid and unchanged until fn was called. */
+int redisAppendCommandArgvBorrowed(redisContext *c, int argc, const char **argv,
+                                   const size_t *argvlen, redisWrittenFn *fn, void *privdata);
+
+/* Build a command argument by argument straight into the output buffer, with
+ * no format string and no temporary allocations. Integers are converted with
+ * a digit pair table, doubles are written with the fewest digits that read
+ * back as the same value (NaN is refused). Once argc arguments were added,
+ * redisCommandFinish() appends the command like redisAppendCommand() does.
+ * Any failure drops the partial command and ends the build. Nothing may be
+ * written to or read from the context until the build is finished. */
+int redisCommandBegin(redisContext *c, int argc);
+int redisCommandAddString(redisContext *c, const char *str);
+int redisCommandAddBinary(redisContext *c, const void *buf, size_t len);
+int redisCommandAddInt64(redisContext *c, int64_t value);
+int redisCommandAddDouble(redisContext *c, double value);
+int redisCommandFinish(redisContext *c);
+void redisCommandAbort(redisContext *c);
 
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
@@ -346,5 +557,47 @@ int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const s
 [[nodiscard]] void *redisCommand(redisContext *c, const char *format, ...);
 [[nodiscard]] void *redisCommandArgv(redisContext *c, int argc, const char **argv,
                                      const size_t *argvlen);
+[[nodiscard]] void *redisCommandArgs(redisContext *c, int argc, const redisArg *args);
+[[nodiscard]] void *redisvTemplateCommand(redisContext *c, const redisCommandTemplate *t,
+                                          va_list ap);
+[[nodiscard]] void *redisTemplateCommand(redisContext *c, const redisCommandTemplate *t, ...);
+
+/* GET key in a blocking context and write the value to fd instead of building
+ * a string reply. Only the bulk header is parsed: bytes the reader already
+ * holds are written first and the rest of the payload is spliced from the
+ * socket to fd through a pipe on Linux, so it never enters user space. TLS
+ * connections and other systems copy it through a small buffer. Replies to
+ * commands appended before must have been read.
+ *
+ * Returns an integer reply with the number of bytes written to fd, or the nil
+ * or error reply of the server. When writing to fd fails, the rest of the
+ * payload is still read and discarded so the connection stays usable, and an
+ * error reply "FDERR <strerror>" is returned. nullptr is returned when the
+ * connection failed, with the error in the context. A non-blocking fd is
+ * waited for with poll(), for at most the command timeout each time; when it
+ * stays full longer, nullptr is returned with REDIS_ERR_TIMEOUT. */
+[[nodiscard]] void *redisGetToFd(redisContext *c, const char *key, size_t keylen, int fd);
+
+/* Callbacks of redisPipeline(). feed appends the next commands and returns
+ * how many, 0 once there are no more or REDIS_ERR to stop. reply gets each
+ * reply in order and owns it. */
+typedef int(redisPipelineFeedFn)(redisContext *c, void *privdata);
+typedef void(redisPipelineReplyFn)(redisContext *c, void *reply, void *privdata);
+
+/* Run a pipeline of any length on a blocking context in bounded memory.
+ * Commands are taken from feed while less than max_inflight bytes of them
+ * wait to be sent or answered, and replies are handed to fn (or freed when
+ * it is nullptr) as they arrive. Plain sockets are written and read at the
+ * same time, so neither side stalls on a full buffer; other transports
+ * alternate between writing and reading what is in flight. The command
+ * timeout applies to each wait for the socket. Only feed may append commands,
+ * since it reports how many replies they take; the pipeline fails when fn
+ * appends one. Neither may wait for replies itself.
+ *
+ * The output buffer must be empty and replies to commands appended before
+ * must have been read. Returns REDIS_OK once every command was answered,
+ * REDIS_ERR with the error in the context otherwise. */
+int redisPipeline(redisContext *c, redisPipelineFeedFn *feed, redisPipelineReplyFn *fn,
+                  void *privdata, size_t max_inflight);
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef __HIREDIS_URING_H
+#define __HIREDIS_URING_H
+
+#include "hiredis/async.h"
+#include "hiredis/hiredis.h"
+
+/* io_uring transport for Linux.
+ *
+ * Async contexts attached to a redisUring share one ring. Every connection
+ * keeps a multishot recv armed on the ring's provided buffers, whose bytes
+ * are fed to the reader right where the kernel put them, and the sends of all
+ * connections are submitted together by one io_uring_enter() per tick.
+ *
+ * Blocking contexts get a small private ring with redisInitiateUring(). Every
+ * write is submitted together with a linked recv, so a command and its reply
+ * take a single system call.
+ *
+ * Only plain TCP and unix socket contexts are supported. Where io_uring (or
+ * the multishot recv and provided buffer rings it needs, Linux 6.0) is not
+ * available, redisUringCreate() returns nullptr and redisInitiateUring()
+ * fails without touching the context, so callers keep using the poll or
+ * libuv adapters and the plain socket calls. */
+
+typedef struct redisUring redisUring;
+
+/* Size of the provided buffers multishot receives land in. */
+[[maybe_unused]] static constexpr size_t REDIS_URING_BUFSIZE = 16 * 1'024;
+
+/* Largest send staged for a connection at a time. */
+[[maybe_unused]] static constexpr size_t REDIS_URING_SEND_MAX = 256 * 1'024;
+
+/* Create a ring for async contexts. entries sizes the submission queue and
+ * the number of REDIS_URING_BUFSIZE receive buffers shared by the attached
+ * connections, it is rounded up to a power of two. Returns nullptr with
+ * errno set when io_uring can't be used here. */
+[[nodiscard]] redisUring *redisUringCreate(unsigned entries);
+
+/* Free a ring once all of its async contexts were freed or disconnected. */
+void redisUringFree(redisUring *ring);
+
+/* Attach an async context to the ring. This replaces the context's event
+ * hooks and its redisContextFuncs, so it can't be combined with TLS or with
+ * another adapter. */
+int redisUringAttach(redisAsyncContext *ac, redisUring *ring);
+
+/* Submit the I/O queued by the attached contexts in one system call, then
+ * dispatch completions and expired timeouts. The timeout argument can be
+ * positive to wait for a maximum given time, zero to poll, or negative to wait
+ * forever. Returns the number of events handled, or -1 with errno set. Must not
+ * be called from a callback. */
+int redisUringTick(redisUring *ring, double timeout);
+
+/* Move a connected blocking context to io_uring. On REDIS_ERR the context is
+ * left as it was and keeps using plain socket calls.
+ *
+ * A write waits for the first bytes of the reply along with the send. Output
+ * that gets no reply (commands after CLIENT REPLY OFF) must therefore not be
+ * flushed on its own, unless a command timeout bounds that wait. */
+int redisInitiateUring(redisContext *c);
+
+#endif /* __HIREDIS_URING_H */
@@ -49,9 +49,97 @@ int redisContextConnectBindTcp(redisContext *c, const char *addr, int port,
                                const struct timeval *timeout, const char *source_addr);
 int redisContextConnectUnix(redisContext *c, const char *path, const struct timeval *timeout);
 int redisKeepAlive(redisContext *c, int interval);
+int redisContextSetBlocking(redisContext *c, int blocking);
+
+/* Wait up to msec (-1 for ever) for the socket to turn readable or, when
+ * *writable is set, writable. Both are set to what it turned, neither on a
+ * timeout. */
+int redisContextWaitIo(redisContext *c, bool *readable, bool *writable, long msec);
+
+/* Resolver threads started at most for REDIS_OPT_ASYNC_DNS lookups */
+[[maybe_unused]] static constexpr int REDIS_RESOLVER_THREADS = 4;
+
+/* Host names kept in the REDIS_OPT_SHARED_DNS_CACHE address cache */
+[[maybe_unused]] static constexpr int REDIS_DNS_CACHE_HOSTS = 64;
 int redisCheckConnectDone(redisContext *c, int *completed);
 
 int redisSetTcpNoDelay(redisContext *c);
 int redisContextSetTcpUserTimeout(redisContext *c, unsigned int timeout);
+int redisSetZeroCopy(redisContext *c, size_t threshold);
+int redisSetBusyPoll(redisContext *c, unsigned int usec, bool sockopt);
+int redisSetTcpCork(redisContext *c, int on);
+
+/* Write payload bytes at buf to c->tofd.fd, see redisGetToFd(). What a
+ * non-blocking fd does not take right now is kept in c->tofd.pipe, up to a
+ * buffer of it, and written first the next time. Returns the bytes taken,
+ * fewer than len only while bytes wait in the pipe. Once writing to fd failed
+ * its errno is kept in c->tofd.err and the payload is discarded. */
+size_t redisNetWriteToFd(redisContext *c, const char *buf, size_t len);
+/* Write out the payload bytes waiting in c->tofd.pipe. Returns false while
+ * c->tofd.fd would block, nothing waits for it to drain. */
+bool redisNetFlushToFd(redisContext *c);
+/* Move up to len payload bytes of the reply being received from the socket
+ * to c->tofd.fd. Returns the bytes taken from the socket, 0 when none can be
+ * read right now or bytes still wait in the pipe, or -1 with the error set in
+ * the context. */
+ssize_t redisNetReadToFd(redisContext *c, size_t len);
+/* Drop the payload bytes waiting in the pipe and close it. */
+void redisNetCloseToFd(redisContext *c);
+
+/* Pipe size asked for when splicing a payload to a descriptor */
+[[maybe_unused]] static constexpr size_t REDIS_TOFD_PIPE = 1'024 * 1'024;
+
+/* Arguments of at least this many bytes are not copied into obuf but queued
+ * as a separate buffer and written with scatter-gather I/O. */
+[[maybe_unused]] static constexpr size_t REDIS_OUTREF_MIN = 16 * 1'024;
+
+/* Flags for redisOutRef.flags */
+[[maybe_unused]] static constexpr int REDIS_OUTREF_OWNED = 0b01; /* data is hi_free'd when sent */
+[[maybe_unused]] static constexpr int REDIS_OUTREF_ZEROCOPY = 0b10; /* Sent with MSG_ZEROCOPY */
+[[maybe_unused]] static constexpr int REDIS_OUTREF_FILE = 0b100; /* Bytes come from fd */
+
+/* File refs that can't be sent with sendfile() are read this much at a time. */
+[[maybe_unused]] static constexpr size_t REDIS_OUTREF_CHUNK = 64 * 1'024;
+
+/* A buffer written out after the first offset bytes of obuf. A ref without
+ * data only marks a position to call done at. With REDIS_OUTREF_FILE the bytes
+ * are read from fd at fileoff instead, data then holds the chunk that was
+ * read last, if any. */
+typedef struct redisOutRef {
+  struct redisOutRef *next;
+  size_t offset; /* Position in obuf */
+  const char *data;
+  size_t len;
+  size_t sent;
+  int flags;
+  redisWrittenFn *done; /* Called once everything up to the end of data was written */
+  void *privdata;
+  uint32_t zcseq; /* Last zerocopy send of data, with REDIS_OUTREF_ZEROCOPY */
+  int fd;
+  long long fileoff;
+  size_t chunkoff; /* Offset of the chunk in data, relative to fileoff */
+  size_t chunklen;
+} redisOutRef;
+
+struct iovec;
+
+/* Maximum number of buffers handed to a single sendmsg() call. */
+[[maybe_unused]] static constexpr int REDIS_IOV_MAX = 64;
+
+/* Output queue used by redisContextFuncs.write implementations. Fill iov with
+ * the pending output (returns the number of entries used) or peek at its
+ * first contiguous region, write it, then report how much was written with
+ * redisOutputConsume(), which is done by redisBufferWrite(). */
+size_t redisOutputPending(const redisContext *c);
+int redisOutputIov(const redisContext *c, struct iovec *iov, int iovcnt);
+const char *redisOutputPeek(redisContext *c, size_t *len);
+int redisOutputConsume(redisContext *c, size_t len);
+
+/* The file ref the output continues with, when redisOutputIov() stopped at
+ * one. Peeking reads a chunk of it (nullptr with c->err set on failure). */
+redisOutRef *redisOutputFile(const redisContext *c);
+
+/* Release the written refs whose zerocopy sends c->zerocopy.completed covers. */
+void redisOutputZeroCopyDone(redisContext *c);
 
 #endif
@@ -69,6 +69,14 @@
 /* Default multi-bulk element limit */
 [[maybe_unused]] static constexpr long long REDIS_READER_MAX_ARRAY_ELEMENTS = (1LL << 32) - 1;
 
+/* Flags for redisReader.mmapflags, hints for how bulk strings at or above
+ * redisReader.mmapthreshold are mapped. HUGETLB falls back to THP when no
+ * huge pages are reserved. The reader adds REDIS_READER_MMAP itself when it
+ * asks createStringBuffer() for a mapping. */
+[[maybe_unused]] static constexpr int REDIS_READER_MMAP_HUGETLB = 0b001;
+[[maybe_unused]] static constexpr int REDIS_READER_MMAP_THP = 0b010;
+[[maybe_unused]] static constexpr int REDIS_READER_MMAP = 0b100;
+
 typedef struct redisReadTask {
   int type;
   long long elements;           /* number of elements in multibulk container */
@@ -86,6 +94,12 @@ typedef struct redisReplyObjectFunctions {
   void *(*createNil)(const redisReadTask *);
   void *(*createBool)(const redisReadTask *, int);
   void (*freeObject)(void *);
+  /* Optional. Create a string object of len bytes and return the storage for
+   * its payload, aligned to at least align bytes, in *buf; the reader fills it
+   * in as the bytes arrive. Used for bulk strings when redisReader.stralign is
+   * set or the length reaches redisReader.mmapthreshold. */
+  void *(*createStringBuffer)(const redisReadTask *, size_t len, size_t align, int flags,
+                              char **buf);
 } redisReplyObjectFunctions;
 
 typedef struct redisReader {
@@ -106,6 +120,16 @@ typedef struct redisReader {
 
   redisReplyObjectFunctions *fn;
   void *privdata;
+
+  size_t mmapthreshold; /* Min length of mapped bulk strings, 0 to disable */
+  int mmapflags;        /* REDIS_READER_MMAP_* */
+  size_t stralign;      /* Bulk string alignment (power of two), 0 for malloc's,
+                         * see redisReaderSetStrAlign() */
+
+  /* Bulk string being received in place */
+  char *bulk;
+  size_t bulklen;
+  size_t bulkpos;
 } redisReader;
 
 /* Public API for the protocol parser. */
@@ -114,6 +138,16 @@ void redisReaderFree(redisReader *r);
 int redisReaderFeed(redisReader *r, const char *buf, size_t len);
 int redisReaderGetReply(redisReader *r, void **reply);
 
+/* While a bulk string is being received in place and nothing else is buffered,
+ * return where the next payload bytes go so they can be read there directly,
+ * and how many are still missing. Report them with redisReaderBulkWritten(). */
+char *redisReaderBulkBuffer(redisReader *r, size_t *len);
+void redisReaderBulkWritten(redisReader *r, size_t len);
+
+/* Set redisReader.stralign. Returns REDIS_ERR, leaving it as it was, when
+ * align is neither 0 nor a power of two. */
+int redisReaderSetStrAlign(redisReader *r, size_t align);
+
 #define redisReaderSetPrivdata(_r, _p) (int)(((redisReader *)(_r))->privdata = (_p))
 #define redisReaderGetObject(_r) (((redisReader *)(_r))->reply)
 #define redisReaderGetError(_r) (((redisReader *)(_r))->errstr)
@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hiredis/alloc.h"
+#include "hiredis/aof.h"
+
+/* Outcome of parsing something at a given offset. Truncation is kept apart
+ * from malformed input because a chunk scan needs to tell "ran off the end of
+ * the file" from "this was never a command boundary". */
+enum { AOF_PARSE_OK = 0, AOF_PARSE_BAD = -1, AOF_PARSE_TRUNCATED = -2 };
+
+static void __redisAofSetError(int *err, char *errstr, size_t errlen, int type, const char *str) {
+  auto len = strlen(str);
+
+  *err = type;
+  len = len < (errlen - 1) ? len : (errlen - 1);
+  memcpy(errstr, str, len);
+  errstr[len] = '\0';
+}
+
+static void __redisAofSetErrorFromErrno(redisAof *aof, const char *prefix) {
+  char buf[sizeof(aof->errstr)];
+
+  snprintf(buf, sizeof(buf), "%s: %s", prefix, strerror(errno));
+  __redisAofSetError(&aof->err, aof->errstr, sizeof(aof->errstr), REDIS_ERR_IO, buf);
+}
+
+redisAof *redisAofOpen(const char *path) {
+  struct stat st;
+  int flags = O_RDONLY;
+  int fd;
+
+  redisAof *aof = hi_calloc(1, sizeof(*aof));
+  if (aof == nullptr)
+    return nullptr;
+
+#ifdef O_CLOEXEC
+  flags |= O_CLOEXEC;
+#endif
+
+  if ((fd = open(path, flags)) == -1) {
+    __redisAofSetErrorFromErrno(aof, "open");
+    return aof;
+  }
+
+  if (fstat(fd, &st) == -1) {
+    __redisAofSetErrorFromErrno(aof, "fstat");
+    close(fd);
+    return aof;
+  }
+
+  /* mmap(2) refuses zero length mappings, an empty file simply has no
+   * commands. */
+  if (st.st_size > 0) {
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      __redisAofSetErrorFromErrno(aof, "mmap");
+      close(fd);
+      return aof;
+    }
+    aof->buf = map;
+    aof->len = (size_t)st.st_size;
+
+    /* Only a hint: failing to apply it is not an error. */
+    (void)posix_madvise(map, aof->len, POSIX_MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  /* Since Redis 7 the base file of a multi part AOF may be an RDB file. */
+  if (aof->len >= 5 && memcmp(aof->buf, "REDIS", 5) == 0) {
+    __redisAofSetError(&aof->err, aof->errstr, sizeof(aof->errstr), REDIS_ERR_OTHER,
+                       "RDB preamble is not supported");
+  }
+
+  return aof;
+}
+
+void redisAofClose(redisAof *aof) {
+  if (aof == nullptr)
+    return;
+
+  if (aof->buf != nullptr)
+    munmap((void *)aof->buf, aof->len);
+  hi_free(aof);
+}
+
+/* Parse "<prefix><digits>\r\n" at p. The value must fit in a long long, as
+ * Redis itself would refuse anything larger when loading the file. */
+static int aofParseLength(const char *p, const char *end, char prefix, size_t *value,
+                          const char **next) {
+  size_t v = 0;
+  const char *s;
+
+  if (p >= end)
+    return AOF_PARSE_TRUNCATED;
+  if (*p != prefix)
+    return AOF_PARSE_BAD;
+
+  for (s = p + 1; s < end && *s >= '0' && *s <= '9'; s++) {
+    if (v > (size_t)(LLONG_MAX - (*s - '0')) / 10)
+      return AOF_PARSE_BAD;
+    v = (v * 10) + (size_t)(*s - '0');
+  }
+
+  if (s == p + 1 && s < end)
+    return AOF_PARSE_BAD;
+  if (end - s < 2)
+    return AOF_PARSE_TRUNCATED;
+  if (s[0] != '\r' || s[1] != '\n')
+    return AOF_PARSE_BAD;
+
+  *value = v;
+  *next = s + 2;
+  return AOF_PARSE_OK;
+}
+
+/* Skip a "#..." annotation line (e.g. the timestamps written with
+ * aof-timestamp-enabled). */
+static int aofSkipAnnotation(const char *p, const char *end, const char **next) {
+  const char *s = p;
+
+  while ((s = memchr(s, '\r', (size_t)(end - s))) != nullptr) {
+    if (end - s < 2)
+      return AOF_PARSE_TRUNCATED;
+    if (s[1] == '\n') {
+      *next = s + 2;
+      return AOF_PARSE_OK;
+    }
+    s++;
+  }
+  return AOF_PARSE_TRUNCATED;
+}
+
+/* Parse one command at p. When argv is nullptr only the boundaries are
+ * checked, which is all redisAofSync() needs. */
+static int aofParseCommand(const char *p, const char *end, size_t *argc, const char **argv,
+                           size_t *argvlen, size_t argvcap, const char **next) {
+  size_t count, len;
+  int rv;
+
+  if ((rv = aofParseLength(p, end, '*', &count, &p)) != AOF_PARSE_OK)
+    return rv;
+  if (count == 0 || count > INT_MAX)
+    return AOF_PARSE_BAD;
+
+  for (size_t j = 0; j < count; j++) {
+    if ((rv = aofParseLength(p, end, '$', &len, &p)) != AOF_PARSE_OK)
+      return rv;
+    if ((size_t)(end - p) < len + 2)
+      return AOF_PARSE_TRUNCATED;
+    if (p[len] != '\r' || p[len + 1] != '\n')
+      return AOF_PARSE_BAD;
+
+    if (argv != nullptr && j < argvcap) {
+      argv[j] = p;
+      argvlen[j] = len;
+    }
+    p += len + 2;
+  }
+
+  *argc = count;
+  *next = p;
+  return AOF_PARSE_OK;
+}
+
+size_t redisAofSync(const redisAof *aof, size_t offset) {
+  const char *start = aof->buf;
+  const char *end = aof->buf + aof->len;
+  const char *p;
+
+  if (offset == 0 || offset >= aof->len)
+    return offset < aof->len ? offset : aof->len;
+
+  for (p = start + offset - 1; p < end; p++) {
+    /* A command always starts a line. */
+    p = memchr(p, '\n', (size_t)(end - p));
+    if (p == nullptr || ++p >= end)
+      break;
+    if (*p != '*' && *p != '#')
+      continue;
+
+    const char *q = p;
+    int parsed = 0, rv = AOF_PARSE_OK;
+    while (parsed < REDIS_AOF_SYNC_COMMANDS && q < end) {
+      size_t argc;
+
+      if (*q == '#') {
+        rv = aofSkipAnnotation(q, end, &q);
+      } else {
+        rv = aofParseCommand(q, end, &argc, nullptr, nullptr, 0, &q);
+        parsed++;
+      }
+      if (rv != AOF_PARSE_OK)
+        break;
+    }
+
+    /* Running into the end of the file after at least one good command is
+     * as much evidence as we are going to get. */
+    if (rv == AOF_PARSE_OK || (rv == AOF_PARSE_TRUNCATED && parsed > 1))
+      return (size_t)(p - start);
+    p--;
+  }
+
+  return aof->len;
+}
+
+void redisAofIterInit(redisAofIterator *it, const redisAof *aof, size_t start, size_t end) {
+  memset(it, 0, sizeof(*it));
+  it->aof = aof;
+  it->pos = start < aof->len ? start : aof->len;
+  it->end = end < aof->len ? end : aof->len;
+
+  /* Start read-ahead for the chunk; every iterator of a parallel scan does
+   * this for its own range. */
+  if (it->end > it->pos) {
+    auto pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    auto base = it->pos - (it->pos % pagesize);
+    (void)posix_madvise((void *)(aof->buf + base), it->end - base, POSIX_MADV_WILLNEED);
+  }
+}
+
+void redisAofIterReset(redisAofIterator *it) {
+  hi_free(it->cmd.argv);
+  hi_free(it->cmd.argvlen);
+  it->cmd.argv = nullptr;
+  it->cmd.argvlen = nullptr;
+  it->argvcap = 0;
+}
+
+static int __redisAofIterGrow(redisAofIterator *it, size_t argc) {
+  auto cap = it->argvcap > 0 ? (size_t)it->argvcap : 8;
+  while (cap < argc)
+    cap *= 2;
+  if (cap > INT_MAX)
+    return REDIS_ERR;
+
+  const char **argv = hi_realloc(it->cmd.argv, cap * sizeof(*argv));
+  if (argv == nullptr)
+    return REDIS_ERR;
+  it->cmd.argv = argv;
+
+  size_t *argvlen = hi_realloc(it->cmd.argvlen, cap * sizeof(*argvlen));
+  if (argvlen == nullptr)
+    return REDIS_ERR;
+  it->cmd.argvlen = argvlen;
+
+  it->argvcap = (int)cap;
+  return REDIS_OK;
+}
+
+int redisAofNext(redisAofIterator *it, redisAofCommand **cmd) {
+  const char *end = it->aof->buf + it->aof->len;
+  char errbuf[sizeof(it->errstr)];
+  size_t argc;
+  const char *p, *next;
+  int rv;
+
+  *cmd = nullptr;
+  if (it->err)
+    return REDIS_ERR;
+
+  while (it->pos < it->end) {
+    p = it->aof->buf + it->pos;
+
+    if (*p == '#') {
+      rv = aofSkipAnnotation(p, end, &next);
+      if (rv != AOF_PARSE_OK)
+        goto error;
+      it->pos = (size_t)(next - it->aof->buf);
+      continue;
+    }
+
+    rv = aofParseCommand(p, end, &argc, it->cmd.argv, it->cmd.argvlen, (size_t)it->argvcap, &next);
+    if (rv != AOF_PARSE_OK)
+      goto error;
+
+    /* First time we see this many arguments: grow and parse again, which
+     * only costs a second pass over the length headers. */
+    if (argc > (size_t)it->argvcap) {
+      if (__redisAofIterGrow(it, argc) != REDIS_OK) {
+        __redisAofSetError(&it->err, it->errstr, sizeof(it->errstr), REDIS_ERR_OOM,
+                           "Out of memory");
+        return REDIS_ERR;
+      }
+      aofParseCommand(p, end, &argc, it->cmd.argv, it->cmd.argvlen, (size_t)it->argvcap, &next);
+    }
+
+    it->cmd.offset = it->pos;
+    it->cmd.len = (size_t)(next - p);
+    it->cmd.argc = (int)argc;
+    it->pos += it->cmd.len;
+
+    *cmd = &it->cmd;
+    return REDIS_OK;
+  }
+
+  return REDIS_OK;
+
+error:
+  if (rv == AOF_PARSE_TRUNCATED) {
+    snprintf(errbuf, sizeof(errbuf), "Truncated command at offset %zu", it->pos);
+    __redisAofSetError(&it->err, it->errstr, sizeof(it->errstr), REDIS_ERR_EOF, errbuf);
+  } else {
+    snprintf(errbuf, sizeof(errbuf), "Protocol error at offset %zu", it->pos);
+    __redisAofSetError(&it->err, it->errstr, sizeof(it->errstr), REDIS_ERR_PROTOCOL, errbuf);
+  }
+  return REDIS_ERR;
+}
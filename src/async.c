@@ -51,7 +51,18 @@
 
 /* Forward declarations of hiredis.c functions */
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len);
+int __redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen,
+                             redisWrittenFn *fn, void *privdata);
+int __redisAppendWritten(redisContext *c, redisWrittenFn *fn, void *privdata);
+int __redisTemplateCat(sds *target, const redisCommandTemplate *t, va_list ap);
+long long __redisFormatCat(sds *target, const char *format, va_list ap);
+long long __redisArgsCat(sds *target, int argc, const redisArg *args);
+int __redisOutputCompact(redisContext *c);
+void __redisOutputTruncate(redisContext *c, struct redisOutRef *tail, size_t mark);
+const char *__redisTemplateName(const redisCommandTemplate *t, size_t *len);
 void __redisSetError(redisContext *c, int type, const char *str);
+int __redisReplyDropRef(redisReply *r);
+int __redisGetReplyToFd(redisContext *c, int fd, void **reply);
 
 /* Functions managing dictionary of callbacks for pub/sub. */
 static unsigned int callbackHash(const void *key) {
@@ -122,6 +133,7 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
   ac->ev.delWrite = nullptr;
   ac->ev.cleanup = nullptr;
   ac->ev.scheduleTimer = nullptr;
+  ac->ev.updateFd = nullptr;
 
   ac->onConnect = nullptr;
   ac->onConnectNC = nullptr;
@@ -135,6 +147,12 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
   ac->sub.patterns = patterns;
   ac->sub.pending_unsubs = 0;
 
+  ac->lazyfree.threshold = 0;
+  ac->lazyfree.budget = REDIS_LAZYFREE_BUDGET;
+  ac->lazyfree.stack = nullptr;
+  ac->lazyfree.depth = 0;
+  ac->lazyfree.cap = 0;
+
   return ac;
 oom:
   if (channels)
@@ -287,6 +305,19 @@ static int __redisShiftCallback(redisCallbackList *list, redisCallback *target)
   return REDIS_ERR;
 }
 
+/* Register the callback for the reply to the command being sent. There is no
+ * reply to wait for after CLIENT REPLY OFF, or right after CLIENT REPLY SKIP. */
+static int __redisPushReplyCallback(redisAsyncContext *ac, redisCallbackList *list,
+                                    redisCallback *cb) {
+  redisContext *c = &(ac->c);
+
+  if (c->flags & (REDIS_NO_REPLIES | REDIS_SKIP_REPLY)) {
+    c->flags &= ~REDIS_SKIP_REPLY;
+    return REDIS_OK;
+  }
+  return __redisPushCallback(list, cb);
+}
+
 static void __redisRunCallback(redisAsyncContext *ac, redisCallback *cb, redisReply *reply) {
   redisContext *c = &(ac->c);
   if (cb->fn != nullptr) {
@@ -339,6 +370,95 @@ static void __redisRunDisconnectCallback(redisAsyncContext *ac, int status) {
   }
 }
 
+/* Position in a reply being freed incrementally: the aggregate and the index
+ * of the next element to free. */
+typedef struct redisLazyFreeFrame {
+  redisReply *reply;
+  size_t idx;
+} redisLazyFreeFrame;
+
+static int redisIsAggregateReply(const redisReply *r) {
+  return r->type == REDIS_REPLY_ARRAY || r->type == REDIS_REPLY_MAP ||
+         r->type == REDIS_REPLY_ATTR || r->type == REDIS_REPLY_SET || r->type == REDIS_REPLY_PUSH;
+}
+
+static int __redisLazyFreePush(redisAsyncContext *ac, redisReply *r) {
+  if (ac->lazyfree.depth == ac->lazyfree.cap) {
+    size_t cap = ac->lazyfree.cap ? ac->lazyfree.cap * 2 : 8;
+    redisLazyFreeFrame *stack = hi_realloc(ac->lazyfree.stack, cap * sizeof(*stack));
+    if (stack == nullptr)
+      return REDIS_ERR;
+    ac->lazyfree.stack = stack;
+    ac->lazyfree.cap = cap;
+  }
+
+  ac->lazyfree.stack[ac->lazyfree.depth].reply = r;
+  ac->lazyfree.stack[ac->lazyfree.depth].idx = 0;
+  ac->lazyfree.depth++;
+  return REDIS_OK;
+}
+
+/* Free up to budget reply objects. Nested aggregates get their own frame
+ * rather than being freed recursively, so the bound holds for any shape. */
+static void __redisLazyFreeStep(redisAsyncContext *ac, size_t budget) {
+  while (ac->lazyfree.depth > 0 && budget > 0) {
+    redisLazyFreeFrame *frame = &ac->lazyfree.stack[ac->lazyfree.depth - 1];
+    redisReply *r = frame->reply;
+
+    if (frame->idx < r->elements) {
+      redisReply *child = r->element[frame->idx++];
+      if (child != nullptr && redisIsAggregateReply(child) && child->elements > 0) {
+        /* Retained elsewhere: dropping our reference is all there is to do. */
+        if (!__redisReplyDropRef(child)) {
+          budget--;
+          continue;
+        }
+        if (__redisLazyFreePush(ac, child) == REDIS_OK)
+          continue;
+      }
+      /* Leaves, or a nested aggregate we could not get a frame for. */
+      freeReplyObject(child);
+    } else {
+      hi_free(r->element);
+      hi_free(r);
+      ac->lazyfree.depth--;
+    }
+    budget--;
+  }
+}
+
+/* Free a reply produced by this context's reader. Large enough replies are
+ * queued and freed in slices from the event loop, which is kept ticking with
+ * write events until the queue is empty. */
+static void __redisAsyncFreeReply(redisAsyncContext *ac, void *reply) {
+  redisContext *c = &(ac->c);
+  redisReply *r = reply;
+
+  if (r == nullptr || ac->lazyfree.threshold == 0 || c->reader->fn->freeObject != freeReplyObject ||
+      !redisIsAggregateReply(r) || r->elements < ac->lazyfree.threshold ||
+      !(c->flags & REDIS_CONNECTED) || (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING))) {
+    c->reader->fn->freeObject(reply);
+    return;
+  }
+
+  /* A callback retained the reply, it is not ours to free anymore. */
+  if (!__redisReplyDropRef(r))
+    return;
+
+  /* Sole owner now, so freeReplyObject() frees it outright. */
+  if (__redisLazyFreePush(ac, r) != REDIS_OK) {
+    freeReplyObject(r);
+    return;
+  }
+
+  _EL_ADD_WRITE(ac);
+}
+
+/* Free everything still queued, used once the event loop stops ticking. */
+static void __redisLazyFreeDrain(redisAsyncContext *ac) {
+  __redisLazyFreeStep(ac, SIZE_MAX);
+}
+
 /* Helper function to free the context. */
 static void __redisAsyncFree(redisAsyncContext *ac) {
   redisContext *c = &(ac->c);
@@ -385,6 +505,9 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     ac->dataCleanup(ac->data);
   }
 
+  __redisLazyFreeDrain(ac);
+  hi_free(ac->lazyfree.stack);
+
   /* Cleanup self */
   redisFree(c);
 }
@@ -425,6 +548,9 @@ void __redisAsyncDisconnect(redisAsyncContext *ac) {
    * this is safe to call multiple times */
   _EL_CLEANUP(ac);
 
+  /* No more ticks to free queued replies in. */
+  __redisLazyFreeDrain(ac);
+
   /* For non-clean disconnects, __redisAsyncFree() will execute pending
    * callbacks with a nullptr-reply. */
   if (!(c->flags & REDIS_NO_AUTO_FREE)) {
@@ -444,8 +570,14 @@ void redisAsyncDisconnect(redisAsyncContext *ac) {
 
   /** unset the auto-free flag here, because disconnect undoes this */
   c->flags &= ~REDIS_NO_AUTO_FREE;
-  if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.head == nullptr)
+  if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.head == nullptr) {
+    /* Commands no reply is waited for, see CLIENT REPLY, still go out first */
+    if (redisOutputPending(c) > 0) {
+      _EL_ADD_WRITE(ac);
+      return;
+    }
     __redisAsyncDisconnect(ac);
+  }
 }
 
 static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
@@ -547,16 +679,35 @@ static int redisIsSubscribeReply(redisReply *reply) {
          !strncasecmp(str, "unsubscribe", len);
 }
 
+/* Get the next reply, with the payload of a redisAsyncGetToFd() reply going
+ * to its descriptor instead. */
+static int __redisAsyncGetReply(redisAsyncContext *ac, void **reply) {
+  redisCallback *cb = ac->replies.head;
+
+  if (cb != nullptr && cb->tofd) {
+    int status = __redisGetReplyToFd(&ac->c, cb->fd, reply);
+    /* While fd is full the socket may have nothing more to read, a write
+     * event comes back to write out what waits for it */
+    if (status == REDIS_OK && *reply == nullptr && ac->c.tofd.inpipe > 0)
+      _EL_ADD_WRITE(ac);
+    return status;
+  }
+  return redisGetReply(&ac->c, reply);
+}
+
 void redisProcessCallbacks(redisAsyncContext *ac) {
   redisContext *c = &(ac->c);
   void *reply = nullptr;
   int status;
 
-  while ((status = redisGetReply(c, &reply)) == REDIS_OK) {
+  __redisLazyFreeStep(ac, ac->lazyfree.budget);
+
+  while ((status = __redisAsyncGetReply(ac, &reply)) == REDIS_OK) {
     if (reply == nullptr) {
       /* When the connection is being disconnected and there are
        * no more replies, this is the cue to really disconnect. */
-      if (c->flags & REDIS_DISCONNECTING && sdslen(c->obuf) == 0 && ac->replies.head == nullptr) {
+      if (c->flags & REDIS_DISCONNECTING && redisOutputPending(c) == 0 &&
+          ac->replies.head == nullptr) {
         __redisAsyncDisconnect(ac);
         return;
       }
@@ -575,7 +726,7 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
      * either RESP2 or RESP3 mode. */
     if (redisIsSpontaneousPushReply(reply)) {
       __redisRunPushCallback(ac, reply);
-      c->reader->fn->freeObject(reply);
+      __redisAsyncFreeReply(ac, reply);
       continue;
     }
 
@@ -601,7 +752,7 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
       if (((redisReply *)reply)->type == REDIS_REPLY_ERROR) {
         c->err = REDIS_ERR_OTHER;
         snprintf(c->errstr, sizeof(c->errstr), "%s", ((redisReply *)reply)->str);
-        c->reader->fn->freeObject(reply);
+        __redisAsyncFreeReply(ac, reply);
         __redisAsyncDisconnect(ac);
         return;
       }
@@ -614,8 +765,11 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
 
     if (cb.fn != nullptr) {
       __redisRunCallback(ac, &cb, reply);
+      /* With REDIS_NO_AUTO_FREE_REPLIES our reference moves to the callback,
+       * otherwise it is dropped and a callback that kept the reply must have
+       * retained it. */
       if (!(c->flags & REDIS_NO_AUTO_FREE_REPLIES)) {
-        c->reader->fn->freeObject(reply);
+        __redisAsyncFreeReply(ac, reply);
       }
 
       /* Proceed with free'ing when redisAsyncFree() was called. */
@@ -628,7 +782,7 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
        * or there were no callbacks to begin with. Either way, don't
        * abort with an error, but simply ignore it because the client
        * doesn't know what the server will spit out over the wire. */
-      c->reader->fn->freeObject(reply);
+      __redisAsyncFreeReply(ac, reply);
     }
 
     /* If in monitor mode, repush the callback */
@@ -653,14 +807,21 @@ static void __redisAsyncHandleConnectFailure(redisAsyncContext *ac) {
 static int __redisAsyncHandleConnect(redisAsyncContext *ac) {
   int completed = 0;
   redisContext *c = &(ac->c);
+  bool resolving = c->resolve != nullptr;
 
   if (redisCheckConnectDone(c, &completed) == REDIS_ERR) {
-    /* Error! */
-    if (redisCheckSocketError(c) == REDIS_ERR)
+    /* Error! A failed lookup already set it */
+    if (c->err || redisCheckSocketError(c) == REDIS_ERR)
       __redisAsyncCopyError(ac);
     __redisAsyncHandleConnectFailure(ac);
     return REDIS_ERR;
-  } else if (completed == 1) {
+  }
+
+  /* The socket took the place of the stand-in of the host name lookup */
+  if (resolving && c->resolve == nullptr)
+    _EL_UPDATE_FD(ac);
+
+  if (completed == 1) {
     /* connected! */
     if (c->connection_type == REDIS_CONN_TCP && redisSetTcpNoDelay(c) == REDIS_ERR) {
       __redisAsyncHandleConnectFailure(ac);
@@ -725,11 +886,21 @@ void redisAsyncWrite(redisAsyncContext *ac) {
   if (redisBufferWrite(c, &done) == REDIS_ERR) {
     __redisAsyncDisconnect(ac);
   } else {
-    /* Continue writing when not done, stop writing otherwise */
-    if (!done)
+    /* Continue writing when not done or when replies are still being freed,
+     * stop writing otherwise */
+    if (!done || ac->lazyfree.depth > 0 || c->tofd.inpipe > 0)
       _EL_ADD_WRITE(ac);
     else
       _EL_DEL_WRITE(ac);
+    if (done)
+      c->flags &= ~REDIS_WRITE_WAIT;
+
+    /* A disconnect that was only waiting for the output to be written */
+    if (done && (c->flags & REDIS_DISCONNECTING) && ac->replies.head == nullptr &&
+        !(c->flags & REDIS_IN_CALLBACK)) {
+      __redisAsyncDisconnect(ac);
+      return;
+    }
 
     /* Always schedule reads after writes */
     _EL_ADD_READ(ac);
@@ -750,6 +921,14 @@ void redisAsyncHandleWrite(redisAsyncContext *ac) {
       return;
   }
 
+  __redisLazyFreeStep(ac, ac->lazyfree.budget);
+
+  /* With nothing to send, the event is for a GET payload that waits for its
+   * descriptor, see redisAsyncGetToFd() */
+  if (c->tofd.inpipe > 0 && redisOutputPending(c) == 0) {
+    c->funcs->async_read(ac);
+    return;
+  }
   c->funcs->async_write(ac);
 }
 
@@ -842,18 +1021,77 @@ static const char *nextArgument(const char *start, const char *end, const char *
   return payload + needed;
 }
 
+/* Track the reply mode the server is switched to by CLIENT REPLY, whose
+ * arguments start at p. Returns 1 when the command itself is answered, 0 when
+ * it is not, and -1 when it is some other CLIENT command. */
+static int __redisAsyncClientReply(redisContext *c, const char *p, const char *end) {
+  const char *sub, *mode;
+  size_t sublen, modelen;
+
+  p = nextArgument(p, end, &sub, &sublen);
+  if (p == nullptr || sublen != 5 || strncasecmp(sub, "reply", 5) != 0)
+    return -1;
+  p = nextArgument(p, end, &mode, &modelen);
+  if (p != end)
+    return -1;
+
+  if (modelen == 2 && strncasecmp(mode, "on", 2) == 0) {
+    c->flags &= ~(REDIS_NO_REPLIES | REDIS_SKIP_REPLY);
+    return 1;
+  } else if (modelen == 3 && strncasecmp(mode, "off", 3) == 0) {
+    c->flags |= REDIS_NO_REPLIES;
+    c->flags &= ~REDIS_SKIP_REPLY;
+    return 0;
+  } else if (modelen == 4 && strncasecmp(mode, "skip", 4) == 0) {
+    /* The server ignores SKIP while replies are off */
+    if (!(c->flags & REDIS_NO_REPLIES))
+      c->flags |= REDIS_SKIP_REPLY;
+    return 0;
+  }
+  return -1;
+}
+
+/* Ask the event loop for a write event, which a corked context leaves for
+ * redisAsyncUncork() to do once for the whole batch. With REDIS_OPT_INLINE_WRITE
+ * an idle connection is written to right here, saving a loop iteration. */
+static inline void __redisAsyncScheduleWrite(redisAsyncContext *ac) {
+  redisContext *c = &(ac->c);
+  int done = 0;
+
+  if (c->flags & REDIS_CORKED)
+    return;
+
+  if ((c->flags & (REDIS_INLINE_WRITE | REDIS_CONNECTED | REDIS_WRITE_WAIT)) ==
+          (REDIS_INLINE_WRITE | REDIS_CONNECTED) &&
+      c->funcs->async_write == redisAsyncWrite) {
+    if (redisBufferWrite(c, &done) == REDIS_OK) {
+      /* Replies are expected now, this also refreshes the timeout */
+      _EL_ADD_READ(ac);
+      if (done)
+        return;
+    }
+
+    /* Leave the rest to the write event. A write error is reported from
+     * there too, disconnecting here would free the context under the
+     * caller. */
+    c->flags |= REDIS_WRITE_WAIT;
+  }
+  _EL_ADD_WRITE(ac);
+}
+
 /* Helper function for the redisAsyncCommand* family of functions. Writes a
  * formatted command to the output buffer and registers the provided callback
- * function with the context. */
+ * function with the context. When appended is set the command was already
+ * encoded at the end of obuf and cmd points there. */
 static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
-                               const char *cmd, size_t len) {
+                               const char *cmd, size_t len, int appended) {
   redisContext *c = &(ac->c);
   redisCallback cb;
   struct dict *cbdict;
   dictIterator it;
   dictEntry *de;
   redisCallback *existcb;
-  int pvariant, hasnext;
+  int pvariant, hasnext, replied;
   const char *cstr, *astr;
   size_t clen, alen;
   const char *p;
@@ -870,11 +1108,14 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
   cb.privdata = privdata;
   cb.pending_subs = 1;
   cb.unsubscribe_sent = 0;
+  cb.tofd = false;
 
-  auto newbuf = sdsMakeRoomFor(c->obuf, len);
-  if (newbuf == nullptr)
-    goto oom;
-  c->obuf = newbuf;
+  if (!appended) {
+    auto newbuf = sdsMakeRoomFor(c->obuf, len);
+    if (newbuf == nullptr)
+      goto oom;
+    c->obuf = newbuf;
+  }
 
   /* Find out which command will be appended. */
   p = nextArgument(cmd, cmd_end, &cstr, &clen);
@@ -978,21 +1219,27 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
     c->flags |= REDIS_MONITORING;
     if (__redisPushCallback(&ac->replies, &cb) != REDIS_OK)
       goto oom;
+  } else if (hasnext && strncasecmp(cstr, "client\r\n", 8) == 0 &&
+             (replied = __redisAsyncClientReply(c, p, cmd_end)) >= 0) {
+    /* CLIENT REPLY OFF and SKIP are not answered themselves */
+    auto list = (c->flags & REDIS_SUBSCRIBED) ? &ac->sub.replies : &ac->replies;
+    if (replied && __redisPushCallback(list, &cb) != REDIS_OK)
+      goto oom;
   } else {
     if (c->flags & REDIS_SUBSCRIBED) {
-      if (__redisPushCallback(&ac->sub.replies, &cb) != REDIS_OK)
+      if (__redisPushReplyCallback(ac, &ac->sub.replies, &cb) != REDIS_OK)
         goto oom;
     } else {
-      if (__redisPushCallback(&ac->replies, &cb) != REDIS_OK)
+      if (__redisPushReplyCallback(ac, &ac->replies, &cb) != REDIS_OK)
         goto oom;
     }
   }
 
-  if (__redisAppendCommand(c, cmd, len) != REDIS_OK)
+  if (!appended && __redisAppendCommand(c, cmd, len) != REDIS_OK)
     goto oom;
 
-  /* Always schedule a write when the write buffer is non-empty */
-  _EL_ADD_WRITE(ac);
+  /* Schedule a write now that the write buffer is non-empty, unless corked */
+  __redisAsyncScheduleWrite(ac);
 
   return REDIS_OK;
 badfmt:
@@ -1005,20 +1252,35 @@ oom:
   return REDIS_ERR;
 }
 
+/* Register the command that was just encoded in the last len bytes of obuf,
+ * and drop it again when it is refused. */
+static int __redisAsyncCommandAppended(redisAsyncContext *ac, redisCallbackFn *fn,
+                                       void *privdata, size_t len) {
+  redisContext *c = &(ac->c);
+  size_t mark = sdslen(c->obuf) - len;
+
+  if (__redisAsyncCommand(ac, fn, privdata, c->obuf + mark, len, 1) != REDIS_OK) {
+    sdssetlen(c->obuf, mark);
+    c->obuf[mark] = '\0';
+    return REDIS_ERR;
+  }
+  return REDIS_OK;
+}
+
 int redisvAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
                        const char *format, va_list ap) {
-  char *cmd;
-  int len;
-  int status;
-  len = redisvFormatCommand(&cmd, format, ap);
+  redisContext *c = &(ac->c);
+  long long len = -1;
+
+  /* Format straight into obuf */
+  if (__redisOutputCompact(c) == REDIS_OK)
+    len = __redisFormatCat(&c->obuf, format, ap);
 
   /* We don't want to pass -1 or -2 to future functions as a length. */
   if (len < 0)
     return REDIS_ERR;
 
-  status = __redisAsyncCommand(ac, fn, privdata, cmd, len);
-  hi_free(cmd);
-  return status;
+  return __redisAsyncCommandAppended(ac, fn, privdata, (size_t)len);
 }
 
 int redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
@@ -1031,31 +1293,336 @@ int redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata
   return status;
 }
 
+int redisAsyncCommandFinish(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata) {
+  redisContext *c = &(ac->c);
+  size_t mark = c->build.mark;
+
+  if (redisCommandFinish(c) != REDIS_OK) {
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  return __redisAsyncCommandAppended(ac, fn, privdata, sdslen(c->obuf) - mark);
+}
+
+/* True when the command needs nothing but a reply callback, i.e. it is not
+ * one of the commands __redisAsyncCommand() has to look into. */
+static int __redisAsyncPlainCommand(const char **argv, const size_t *argvlen) {
+  size_t len = argvlen ? argvlen[0] : strlen(argv[0]);
+  const char *name = argv[0];
+
+  if (len > 0 && tolower(name[0]) == 'p') {
+    name++;
+    len--;
+  }
+  return !((len == 9 && strncasecmp(name, "subscribe", 9) == 0) ||
+           (len == 11 && strncasecmp(name, "unsubscribe", 11) == 0) ||
+           (len == 7 && strncasecmp(name, "monitor", 7) == 0) ||
+           (len == 6 && strncasecmp(name, "client", 6) == 0));
+}
+
+/* Append a plain command straight to the output queue. Large arguments skip
+ * formatting into a temporary command, which would only be copied into obuf
+ * again, and are borrowed when written is given. */
+static int __redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                                   int argc, const char **argv, const size_t *argvlen,
+                                   redisWrittenFn *written, void *wprivdata) {
+  redisContext *c = &(ac->c);
+  redisCallback cb = {.fn = fn, .privdata = privdata, .pending_subs = 1};
+
+  /* Don't accept new commands when the connection is about to be closed. */
+  if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING))
+    return REDIS_ERR;
+
+  /* Append first so a failed append leaves no callback behind */
+  if (__redisOutputCompact(c) != REDIS_OK)
+    goto oom;
+  size_t mark = sdslen(c->obuf);
+  struct redisOutRef *tail = c->out.tail;
+  if (__redisAppendCommandArgv(c, argc, argv, argvlen, written, wprivdata) != REDIS_OK) {
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  if (__redisPushReplyCallback(ac, (c->flags & REDIS_SUBSCRIBED) ? &ac->sub.replies : &ac->replies,
+                               &cb) != REDIS_OK) {
+    __redisOutputTruncate(c, tail, mark);
+    goto oom;
+  }
+
+  /* Schedule a write now that the write buffer is non-empty, unless corked */
+  __redisAsyncScheduleWrite(ac);
+
+  return REDIS_OK;
+oom:
+  __redisSetError(&(ac->c), REDIS_ERR_OOM, "Out of memory");
+  __redisAsyncCopyError(ac);
+  return REDIS_ERR;
+}
+
 int redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc,
                           const char **argv, const size_t *argvlen) {
   sds cmd;
   long long len;
   int status;
+
+  if (argc > 0 && __redisAsyncPlainCommand(argv, argvlen)) {
+    for (int j = 0; j < argc; j++) {
+      if ((argvlen ? argvlen[j] : strlen(argv[j])) >= REDIS_OUTREF_MIN)
+        return __redisAsyncCommandArgv(ac, fn, privdata, argc, argv, argvlen, nullptr, nullptr);
+    }
+  }
   len = redisFormatSdsCommandArgv(&cmd, argc, argv, argvlen);
   if (len < 0)
     return REDIS_ERR;
-  status = __redisAsyncCommand(ac, fn, privdata, cmd, len);
+  status = __redisAsyncCommand(ac, fn, privdata, cmd, len, 0);
   sdsfree(cmd);
   return status;
 }
 
+int redisAsyncCommandArgvBorrowed(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                                  int argc, const char **argv, const size_t *argvlen,
+                                  redisWrittenFn *written, void *wprivdata) {
+  redisContext *c = &(ac->c);
+  sds cmd;
+  long long len;
+
+  if (written == nullptr)
+    return REDIS_ERR;
+  if (argc > 0 && __redisAsyncPlainCommand(argv, argvlen))
+    return __redisAsyncCommandArgv(ac, fn, privdata, argc, argv, argvlen, written, wprivdata);
+
+  /* Pub/sub and monitor are copied like any other command, the callback
+   * still reports when they were written. Its marker is queued behind the
+   * command before the command is registered, which may write it inline. */
+  len = redisFormatSdsCommandArgv(&cmd, argc, argv, argvlen);
+  if (len < 0)
+    return REDIS_ERR;
+  if (__redisOutputCompact(c) != REDIS_OK) {
+    sdsfree(cmd);
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  size_t mark = sdslen(c->obuf);
+  struct redisOutRef *tail = c->out.tail;
+  int status = __redisAppendCommand(c, cmd, (size_t)len);
+  sdsfree(cmd);
+  if (status == REDIS_OK)
+    status = __redisAppendWritten(c, written, wprivdata);
+  if (status != REDIS_OK) {
+    __redisOutputTruncate(c, tail, mark);
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  if (__redisAsyncCommand(ac, fn, privdata, c->obuf + mark, (size_t)len, 1) != REDIS_OK) {
+    __redisOutputTruncate(c, tail, mark);
+    return REDIS_ERR;
+  }
+  return REDIS_OK;
+}
+
+int redisAsyncGetToFd(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *key,
+                      size_t keylen, int fd) {
+  redisContext *c = &(ac->c);
+  redisCallback cb = {.fn = fn, .privdata = privdata, .pending_subs = 1, .tofd = true, .fd = fd};
+  const char *argv[] = {"GET", key};
+  const size_t argvlen[] = {3, keylen};
+
+  /* Don't accept new commands when the connection is about to be closed. */
+  if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING))
+    return REDIS_ERR;
+
+  /* Append first so a failed append leaves no callback behind */
+  if (__redisOutputCompact(c) != REDIS_OK)
+    goto oom;
+  size_t mark = sdslen(c->obuf);
+  struct redisOutRef *tail = c->out.tail;
+  if (__redisAppendCommandArgv(c, 2, argv, argvlen, nullptr, nullptr) != REDIS_OK) {
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+
+  /* Always a regular reply, it is not sent to the subscribe callbacks */
+  if (__redisPushReplyCallback(ac, &ac->replies, &cb) != REDIS_OK) {
+    __redisOutputTruncate(c, tail, mark);
+    goto oom;
+  }
+
+  /* Schedule a write now that the write buffer is non-empty, unless corked */
+  __redisAsyncScheduleWrite(ac);
+  return REDIS_OK;
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+  __redisAsyncCopyError(ac);
+  return REDIS_ERR;
+}
+
+/* File arguments are queued by reference, like large argv arguments, which
+ * is only done for plain commands. */
+static int __redisAsyncCommandFileArgs(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                                       int argc, const redisArg *args) {
+  redisContext *c = &(ac->c);
+  redisCallback cb = {.fn = fn, .privdata = privdata, .pending_subs = 1};
+  const char *name = args[0].data;
+  size_t len = args[0].count;
+
+  if (args[0].type != REDIS_ARG_BUFFER || !__redisAsyncPlainCommand(&name, &len)) {
+    __redisSetError(c, REDIS_ERR_OTHER, "File arguments need a plain command");
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+
+  /* Don't accept new commands when the connection is about to be closed. */
+  if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING))
+    return REDIS_ERR;
+
+  /* Append first so invalid arguments leave no callback behind */
+  if (__redisOutputCompact(c) != REDIS_OK) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  size_t mark = sdslen(c->obuf);
+  struct redisOutRef *tail = c->out.tail;
+  if (redisAppendCommandArgs(c, argc, args) != REDIS_OK) {
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+  if (__redisPushReplyCallback(ac, (c->flags & REDIS_SUBSCRIBED) ? &ac->sub.replies : &ac->replies,
+                               &cb) != REDIS_OK) {
+    __redisOutputTruncate(c, tail, mark);
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    __redisAsyncCopyError(ac);
+    return REDIS_ERR;
+  }
+
+  /* Schedule a write now that the write buffer is non-empty, unless corked */
+  __redisAsyncScheduleWrite(ac);
+  return REDIS_OK;
+}
+
+int redisAsyncCommandArgs(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc,
+                          const redisArg *args) {
+  redisContext *c = &(ac->c);
+  long long len = -1;
+
+  for (int j = 1; j < argc; j++) {
+    if (args[j].type == REDIS_ARG_FILE)
+      return __redisAsyncCommandFileArgs(ac, fn, privdata, argc, args);
+  }
+
+  if (__redisOutputCompact(c) == REDIS_OK)
+    len = __redisArgsCat(&c->obuf, argc, args);
+  if (len < 0)
+    return REDIS_ERR;
+  return __redisAsyncCommandAppended(ac, fn, privdata, (size_t)len);
+}
+
 int redisAsyncFormattedCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
                                const char *cmd, size_t len) {
-  int status = __redisAsyncCommand(ac, fn, privdata, cmd, len);
+  int status = __redisAsyncCommand(ac, fn, privdata, cmd, len, 0);
   return status;
 }
 
+int redisvAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                               const redisCommandTemplate *t, va_list ap) {
+  redisContext *c = &(ac->c);
+  const char *name;
+  size_t len;
+
+  /* With a constant command name that needs no bookkeeping the command is
+   * encoded straight into obuf. */
+  if ((name = __redisTemplateName(t, &len)) != nullptr && __redisAsyncPlainCommand(&name, &len)) {
+    redisCallback cb = {.fn = fn, .privdata = privdata, .pending_subs = 1};
+    auto list = (c->flags & REDIS_SUBSCRIBED) ? &ac->sub.replies : &ac->replies;
+
+    if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING))
+      return REDIS_ERR;
+    if (__redisOutputCompact(c) != REDIS_OK) {
+      __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+      __redisAsyncCopyError(ac);
+      return REDIS_ERR;
+    }
+    size_t mark = sdslen(c->obuf);
+    struct redisOutRef *tail = c->out.tail;
+    if (redisvAppendTemplate(c, t, ap) != REDIS_OK) {
+      __redisAsyncCopyError(ac);
+      return REDIS_ERR;
+    }
+    if (__redisPushReplyCallback(ac, list, &cb) != REDIS_OK) {
+      __redisOutputTruncate(c, tail, mark);
+      __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+      __redisAsyncCopyError(ac);
+      return REDIS_ERR;
+    }
+    __redisAsyncScheduleWrite(ac);
+    return REDIS_OK;
+  }
+
+  if (__redisOutputCompact(c) != REDIS_OK)
+    return REDIS_ERR;
+  size_t before = sdslen(c->obuf);
+  if (__redisTemplateCat(&c->obuf, t, ap) != REDIS_OK)
+    return REDIS_ERR;
+  return __redisAsyncCommandAppended(ac, fn, privdata, sdslen(c->obuf) - before);
+}
+
+int redisAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata,
+                              const redisCommandTemplate *t, ...) {
+  va_list ap;
+  int status;
+  va_start(ap, t);
+  status = redisvAsyncTemplateCommand(ac, fn, privdata, t, ap);
+  va_end(ap);
+  return status;
+}
+
+int redisAsyncSetLazyFree(redisAsyncContext *ac, size_t threshold, size_t budget) {
+  if (threshold > 0 && ac->c.reader->fn->freeObject != freeReplyObject)
+    return REDIS_ERR;
+
+  ac->lazyfree.threshold = threshold;
+  ac->lazyfree.budget = budget > 0 ? budget : REDIS_LAZYFREE_BUDGET;
+  return REDIS_OK;
+}
+
+void redisAsyncFreeReply(redisAsyncContext *ac, void *reply) {
+  __redisAsyncFreeReply(ac, reply);
+}
+
 redisAsyncPushFn *redisAsyncSetPushCallback(redisAsyncContext *ac, redisAsyncPushFn *fn) {
   redisAsyncPushFn *old = ac->push_cb;
   ac->push_cb = fn;
   return old;
 }
 
+void redisAsyncCork(redisAsyncContext *ac) {
+  redisContext *c = &(ac->c);
+
+  if (c->flags & REDIS_CORKED)
+    return;
+  c->flags |= REDIS_CORKED;
+
+  /* Only a hint, a batch is still written in one go without it */
+  if (c->flags & REDIS_TCP_CORK)
+    redisSetTcpCork(c, 1);
+}
+
+void redisAsyncUncork(redisAsyncContext *ac) {
+  redisContext *c = &(ac->c);
+
+  if (!(c->flags & REDIS_CORKED))
+    return;
+  c->flags &= ~REDIS_CORKED;
+
+  /* A write event that was already scheduled may have flushed part of the
+   * batch into the corked socket; clearing the option pushes it out. */
+  if (c->flags & REDIS_TCP_CORK)
+    redisSetTcpCork(c, 0);
+
+  if (redisOutputPending(c) > 0 && !(c->flags & REDIS_FREEING))
+    _EL_ADD_WRITE(ac);
+}
+
 int redisAsyncSetTimeout(redisAsyncContext *ac, struct timeval tv) {
   if (!ac->c.command_timeout) {
     ac->c.command_timeout = hi_calloc(1, sizeof(tv));
@@ -35,9 +35,14 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "hiredis/alloc.h"
 #include "hiredis/async.h"
@@ -62,12 +67,15 @@ static void *createIntegerObject(const redisReadTask *task, long long value);
 static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len);
 static void *createNilObject(const redisReadTask *task);
 static void *createBoolObject(const redisReadTask *task, int bval);
+static void *createStringBufferObject(const redisReadTask *task, size_t len, size_t align,
+                                      int flags, char **buf);
+static void redisFreeString(char *str, size_t len, int flags);
 
 /* Default set of functions to build the reply. Keep in mind that such a
  * function returning nullptr is interpreted as OOM. */
 static redisReplyObjectFunctions defaultFunctions = {
     createStringObject, createArrayObject, createIntegerObject, createDoubleObject,
-    createNilObject,    createBoolObject,  freeReplyObject};
+    createNilObject,    createBoolObject,  freeReplyObject,     createStringBufferObject};
 
 /* Create a reply object */
 static redisReply *createReplyObject(int type) {
@@ -80,12 +88,46 @@ static redisReply *createReplyObject(int type) {
   return r;
 }
 
+/* Drop a reference to r, returns 1 when the caller held the last one and
+ * must free it. Unshared replies never pay for an atomic read-modify-write. */
+int __redisReplyDropRef(redisReply *r) {
+  if (atomic_load_explicit(&r->refs, memory_order_acquire) == 0)
+    return 1;
+  if (atomic_fetch_sub_explicit(&r->refs, 1, memory_order_acq_rel) != 0)
+    return 0;
+
+  /* Lost a race with the other holder's release: we are the last owner now,
+   * undo the wrap around. */
+  atomic_store_explicit(&r->refs, 0, memory_order_relaxed);
+  return 1;
+}
+
+redisReply *redisReplyRetain(redisReply *reply) {
+  if (reply != nullptr)
+    atomic_fetch_add_explicit(&reply->refs, 1, memory_order_relaxed);
+  return reply;
+}
+
+void redisReplyRelease(redisReply *reply) {
+  freeReplyObject(reply);
+}
+
+/* Huge page size used for REDIS_READER_MMAP_HUGETLB mappings. It is passed to
+ * mmap() explicitly so munmap() can recompute the mapping length. */
+static constexpr size_t REDIS_HUGEPAGE_SIZE = 2 * 1'024 * 1'024;
+
+static size_t redisMappedLength(size_t len, int flags) {
+  if (flags & REDIS_REPLY_STR_HUGETLB)
+    return (len + REDIS_HUGEPAGE_SIZE - 1) & ~(REDIS_HUGEPAGE_SIZE - 1);
+  return len;
+}
+
 /* Free a reply object */
 void freeReplyObject(void *reply) {
   redisReply *r = reply;
   size_t j;
 
-  if (r == nullptr)
+  if (r == nullptr || !__redisReplyDropRef(r))
     return;
 
   switch (r->type) {
@@ -110,7 +152,8 @@ void freeReplyObject(void *reply) {
   case REDIS_REPLY_DOUBLE:
   case REDIS_REPLY_VERB:
   case REDIS_REPLY_BIGNUM:
-    hi_free(r->str);
+    if (r->str != nullptr)
+      redisFreeString(r->str, r->len, r->flags);
     break;
   }
   hi_free(r);
@@ -164,6 +207,113 @@ oom:
   return nullptr;
 }
 
+/* Anonymous mapping for a large bulk string. The length is known from the
+ * bulk header, so the mapping is created at its final size and never needs
+ * to grow; freeing it hands the pages straight back to the kernel instead of
+ * leaving a hole in the heap. */
+static char *redisMapString(size_t len, int flags, int *rflags) {
+  char *map = MAP_FAILED;
+
+  *rflags = REDIS_REPLY_STR_MMAP;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  if (flags & REDIS_READER_MMAP_HUGETLB) {
+    constexpr int huge_2mb = 21 << MAP_HUGE_SHIFT;
+    map = mmap(nullptr, redisMappedLength(len + 1, REDIS_REPLY_STR_HUGETLB),
+               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_2mb, -1,
+               0);
+    if (map != MAP_FAILED)
+      *rflags |= REDIS_REPLY_STR_HUGETLB;
+  }
+#endif
+
+  if (map == MAP_FAILED) {
+    map = mmap(nullptr, len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+      return nullptr;
+#ifdef MADV_HUGEPAGE
+    if (flags & (REDIS_READER_MMAP_HUGETLB | REDIS_READER_MMAP_THP))
+      (void)madvise(map, len + 1, MADV_HUGEPAGE);
+#endif
+  }
+
+  return map;
+}
+
+/* Heap allocation of len + 1 bytes aligned to align. The pointer returned by
+ * hi_malloc() is kept right in front of the string for redisFreeString(). */
+static char *redisAllocAlignedString(size_t len, size_t align) {
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if ((align & (align - 1)) != 0 || len > SIZE_MAX - sizeof(void *) - align)
+    return nullptr;
+
+  char *base = hi_malloc(len + 1 + sizeof(void *) + align - 1);
+  if (base == nullptr)
+    return nullptr;
+
+  auto addr = ((uintptr_t)base + sizeof(void *) + align - 1) & ~(uintptr_t)(align - 1);
+  char *str = base + (addr - (uintptr_t)base);
+  ((void **)str)[-1] = base;
+  return str;
+}
+
+static void redisFreeString(char *str, size_t len, int flags) {
+  if (flags & REDIS_REPLY_STR_MMAP)
+    munmap(str, redisMappedLength(len + 1, flags));
+  else if (flags & REDIS_REPLY_STR_ALIGNED)
+    hi_free(((void **)str)[-1]);
+  else
+    hi_free(str);
+}
+
+/* String object whose payload the reader writes in place, either into its
+ * own mapping or into an over-aligned heap block. */
+static void *createStringBufferObject(const redisReadTask *task, size_t len, size_t align,
+                                      int flags, char **buf) {
+  redisReply *r, *parent;
+  char *str;
+  int rflags = 0;
+
+  assert(task->type == REDIS_REPLY_STRING);
+
+  if (len == SIZE_MAX)
+    return nullptr;
+
+  if (flags & REDIS_READER_MMAP) {
+    str = redisMapString(len, flags, &rflags);
+  } else if (align > 0) {
+    str = redisAllocAlignedString(len, align);
+    rflags = REDIS_REPLY_STR_ALIGNED;
+  } else {
+    str = hi_malloc(len + 1);
+  }
+  if (str == nullptr)
+    return nullptr;
+
+  r = createReplyObject(task->type);
+  if (r == nullptr) {
+    redisFreeString(str, len, rflags);
+    return nullptr;
+  }
+
+  str[len] = '\0';
+  r->str = str;
+  r->len = len;
+  r->flags = rflags;
+
+  if (task->parent) {
+    parent = task->parent->obj;
+    assert(parent->type == REDIS_REPLY_ARRAY || parent->type == REDIS_REPLY_MAP ||
+           parent->type == REDIS_REPLY_ATTR || parent->type == REDIS_REPLY_SET ||
+           parent->type == REDIS_REPLY_PUSH);
+    parent->element[task->idx] = r;
+  }
+
+  *buf = str;
+  return r;
+}
+
 static void *createArrayObject(const redisReadTask *task, size_t elements) {
   redisReply *r, *parent;
 
@@ -300,278 +450,413 @@ static uint32_t countDigits(uint64_t v) {
   }
 }
 
+/* Decimal digits of 0 to 99, two per entry. */
+static const char redisDigitPairs[] = "00010203040506070809101112131415161718192021222324"
+                                      "25262728293031323334353637383940414243444546474849"
+                                      "50515253545556575859606162636465666768697071727374"
+                                      "75767778798081828384858687888990919293949596979899";
+
+/* Write the digits decimal digits of v to p and return the end. */
+static char *redisWriteDecimal(char *p, uint64_t v, uint32_t digits) {
+  char *end = p + digits;
+
+  p = end;
+  while (v >= 100) {
+    auto i = (size_t)(v % 100) * 2;
+    v /= 100;
+    *--p = redisDigitPairs[i + 1];
+    *--p = redisDigitPairs[i];
+  }
+  if (v >= 10) {
+    *--p = redisDigitPairs[v * 2 + 1];
+    *--p = redisDigitPairs[v * 2];
+  } else {
+    *--p = (char)('0' + v);
+  }
+  return end;
+}
+
 /* Helper that calculates the bulk length given a certain string length. */
 static size_t bulklen(size_t len) {
   return 1 + countDigits(len) + 2 + len + 2;
 }
 
-int redisvFormatCommand(char **target, const char *format, va_list ap) {
-  const char *c = format;
-  char *cmd = nullptr; /* final command */
-  size_t pos;          /* position in final command */
-  sds curarg, newarg;  /* current argument */
-  int touched = 0;     /* was the current argument touched? */
-  char **curargv = nullptr, **newargv = nullptr;
-  int argc = 0;
-  size_t totlen = 0;
-  int error_type = 0; /* 0 = no error; -1 = memory error; -2 = format error */
-  int j;
+/* Longest printf conversion (including the '%') that is printed, longer ones
+ * consume their value but print nothing. */
+static constexpr size_t REDIS_FMT_SPEC_MAX = 14;
+
+/* Type of the value consumed by a printf conversion in a command format. */
+enum { REDIS_FMT_INT, REDIS_FMT_LONG, REDIS_FMT_LONGLONG, REDIS_FMT_DOUBLE };
+
+/* Parse the printf conversion that starts with the '%' at c. Returns one of
+ * REDIS_FMT_* and points *end at the conversion character, or returns -1 when
+ * the conversion is not supported. */
+static int redisFormatSpec(const char *c, const char **end) {
+  static const char intfmts[] = "diouxX";
+  static const char flags[] = "#0-+ ";
+  const char *_p = c + 1;
+  int type;
+
+  /* Flags */
+  while (*_p != '\0' && strchr(flags, *_p) != nullptr)
+    _p++;
+
+  /* Field width */
+  while (*_p != '\0' && isdigit((int)*_p))
+    _p++;
+
+  /* Precision */
+  if (*_p == '.') {
+    _p++;
+    while (*_p != '\0' && isdigit((int)*_p))
+      _p++;
+  }
 
-  /* Abort if there is not target to set */
-  if (target == nullptr)
+  /* Make sure we have more characters otherwise strchr() accepts
+   * '\0' as an integer specifier. */
+  if (*_p == '\0')
+    return -1;
+
+  /* Integer and double conversions (without modifiers) */
+  if (strchr(intfmts, *_p) != nullptr) {
+    *end = _p;
+    return REDIS_FMT_INT;
+  }
+  if (strchr("eEfFgGaA", *_p) != nullptr) {
+    *end = _p;
+    return REDIS_FMT_DOUBLE;
+  }
+
+  /* Size: char, short, long long, long */
+  if (_p[0] == 'h' && _p[1] == 'h') {
+    _p += 2;
+    type = REDIS_FMT_INT;
+  } else if (_p[0] == 'h') {
+    _p += 1;
+    type = REDIS_FMT_INT;
+  } else if (_p[0] == 'l' && _p[1] == 'l') {
+    _p += 2;
+    type = REDIS_FMT_LONGLONG;
+  } else if (_p[0] == 'l') {
+    _p += 1;
+    type = REDIS_FMT_LONG;
+  } else {
     return -1;
+  }
 
-  /* Build the command string accordingly to protocol */
-  curarg = sdsempty();
-  if (curarg == nullptr)
+  if (*_p == '\0' || strchr(intfmts, *_p) == nullptr)
     return -1;
+  *end = _p;
+  return type;
+}
 
-  while (*c != '\0') {
-    if (*c != '%' || c[1] == '\0') {
-      if (*c == ' ') {
-        if (touched) {
-          newargv = hi_realloc(curargv, sizeof(char *) * (argc + 1));
-          if (newargv == nullptr)
-            goto memory_err;
-          curargv = newargv;
-          curargv[argc++] = curarg;
-          auto bulk = bulklen(sdslen(curarg));
-          if (totlen > SIZE_MAX - bulk)
-            goto memory_err;
-          totlen += bulk;
-
-          /* curarg is put in argv so it can be overwritten. */
-          curarg = sdsempty();
-          if (curarg == nullptr)
-            goto memory_err;
-          touched = 0;
-        }
-      } else {
-        newarg = sdscatlen(curarg, c, 1);
-        if (newarg == nullptr)
-          goto memory_err;
-        curarg = newarg;
-        touched = 1;
-      }
+/* Pieces of a command format, see redisFormatNext(). */
+enum {
+  REDIS_FMT_TOK_END,
+  REDIS_FMT_TOK_SPACE, /* Ends the argument, if any */
+  REDIS_FMT_TOK_TEXT,  /* Plain characters, or the '%' of "%%" */
+  REDIS_FMT_TOK_STR,   /* %s */
+  REDIS_FMT_TOK_BIN,   /* %b */
+  REDIS_FMT_TOK_NUM,   /* printf conversion */
+  REDIS_FMT_TOK_BAD,   /* Unsupported conversion */
+};
+
+typedef struct redisFormatToken {
+  int kind;
+  int type;         /* REDIS_FMT_* of a conversion */
+  const char *text; /* Text, or the spec of a conversion */
+  size_t len;       /* 0 for specs that are too long to be printed */
+} redisFormatToken;
+
+/* Read the token at *c and move *c past it. Returns its kind.
+ *
+ * Runs of plain characters are one token, a '%' at the very end included.
+ * Specs that are too long consume their value but print nothing, and the
+ * rest of the spec is then taken as plain characters. */
+static int redisFormatNext(const char **c, redisFormatToken *tok) {
+  const char *p = *c;
+
+  tok->text = p;
+  tok->len = 0;
+  if (*p == '\0') {
+    tok->kind = REDIS_FMT_TOK_END;
+  } else if (*p == ' ') {
+    tok->kind = REDIS_FMT_TOK_SPACE;
+    p++;
+  } else if (*p != '%' || p[1] == '\0') {
+    tok->kind = REDIS_FMT_TOK_TEXT;
+    do
+      p++;
+    while (*p != '\0' && *p != ' ' && (*p != '%' || p[1] == '\0'));
+    tok->len = (size_t)(p - tok->text);
+  } else if (p[1] == '%') {
+    tok->kind = REDIS_FMT_TOK_TEXT;
+    tok->text = p + 1;
+    tok->len = 1;
+    p += 2;
+  } else if (p[1] == 's' || p[1] == 'b') {
+    tok->kind = p[1] == 's' ? REDIS_FMT_TOK_STR : REDIS_FMT_TOK_BIN;
+    p += 2;
+  } else {
+    const char *end;
+    tok->type = redisFormatSpec(p, &end);
+    if (tok->type < 0) {
+      tok->kind = REDIS_FMT_TOK_BAD;
     } else {
-      char *arg;
-      size_t size;
-
-      /* Set newarg so it can be checked even if it is not touched. */
-      newarg = curarg;
-
-      switch (c[1]) {
-      case 's':
-        arg = va_arg(ap, char *);
-        size = strlen(arg);
-        if (size > 0)
-          newarg = sdscatlen(curarg, arg, size);
-        break;
-      case 'b':
-        arg = va_arg(ap, char *);
-        size = va_arg(ap, size_t);
-        if (size > 0)
-          newarg = sdscatlen(curarg, arg, size);
-        break;
-      case '%':
-        newarg = sdscat(curarg, "%");
-        break;
-      default:
-        /* Try to detect printf format */
-        {
-          static const char intfmts[] = "diouxX";
-          static const char flags[] = "#0-+ ";
-          char _format[16];
-          const char *_p = c + 1;
-          size_t _l = 0;
-          va_list _cpy;
-
-          /* Flags */
-          while (*_p != '\0' && strchr(flags, *_p) != nullptr)
-            _p++;
-
-          /* Field width */
-          while (*_p != '\0' && isdigit((int)*_p))
-            _p++;
-
-          /* Precision */
-          if (*_p == '.') {
-            _p++;
-            while (*_p != '\0' && isdigit((int)*_p))
-              _p++;
-          }
-
-          /* Copy va_list before consuming with va_arg */
-          va_copy(_cpy, ap);
-
-          /* Make sure we have more characters otherwise strchr() accepts
-           * '\0' as an integer specifier. This is checked after above
-           * va_copy() to avoid UB in fmt_invalid's call to va_end(). */
-          if (*_p == '\0')
-            goto fmt_invalid;
-
-          /* Integer conversion (without modifiers) */
-          if (strchr(intfmts, *_p) != nullptr) {
-            va_arg(ap, int);
-            goto fmt_valid;
-          }
-
-          /* Double conversion (without modifiers) */
-          if (strchr("eEfFgGaA", *_p) != nullptr) {
-            va_arg(ap, double);
-            goto fmt_valid;
-          }
-
-          /* Size: char */
-          if (_p[0] == 'h' && _p[1] == 'h') {
-            _p += 2;
-            if (*_p != '\0' && strchr(intfmts, *_p) != nullptr) {
-              va_arg(ap, int); /* char gets promoted to int */
-              goto fmt_valid;
-            }
-            goto fmt_invalid;
-          }
-
-          /* Size: short */
-          if (_p[0] == 'h') {
-            _p += 1;
-            if (*_p != '\0' && strchr(intfmts, *_p) != nullptr) {
-              va_arg(ap, int); /* short gets promoted to int */
-              goto fmt_valid;
-            }
-            goto fmt_invalid;
-          }
-
-          /* Size: long long */
-          if (_p[0] == 'l' && _p[1] == 'l') {
-            _p += 2;
-            if (*_p != '\0' && strchr(intfmts, *_p) != nullptr) {
-              va_arg(ap, long long);
-              goto fmt_valid;
-            }
-            goto fmt_invalid;
-          }
-
-          /* Size: long */
-          if (_p[0] == 'l') {
-            _p += 1;
-            if (*_p != '\0' && strchr(intfmts, *_p) != nullptr) {
-              va_arg(ap, long);
-              goto fmt_valid;
-            }
-            goto fmt_invalid;
-          }
-
-        fmt_invalid:
-          va_end(_cpy);
-          goto format_err;
-
-        fmt_valid:
-          _l = (_p + 1) - c;
-          if (_l < sizeof(_format) - 2) {
-            memcpy(_format, c, _l);
-            _format[_l] = '\0';
-            newarg = sdscatvprintf(curarg, _format, _cpy);
-
-            /* Update current position (note: outer blocks
-             * increment c twice so compensate here) */
-            c = _p - 1;
-          }
-
-          va_end(_cpy);
-          break;
-        }
+      tok->kind = REDIS_FMT_TOK_NUM;
+      size_t len = (size_t)(end + 1 - p);
+      if (len < REDIS_FMT_SPEC_MAX) {
+        tok->len = len;
+        p = end + 1;
+      } else {
+        p += 2;
       }
-
-      if (newarg == nullptr)
-        goto memory_err;
-      curarg = newarg;
-
-      touched = 1;
-      c++;
-      if (*c == '\0')
-        break;
     }
-    c++;
   }
+  *c = p;
+  return tok->kind;
+}
 
-  /* Add the last argument if needed */
-  if (touched) {
-    newargv = hi_realloc(curargv, sizeof(char *) * (argc + 1));
-    if (newargv == nullptr)
-      goto memory_err;
-    curargv = newargv;
-    curargv[argc++] = curarg;
-    auto bulk = bulklen(sdslen(curarg));
-    if (totlen > SIZE_MAX - bulk)
-      goto memory_err;
-    totlen += bulk;
-  } else {
-    sdsfree(curarg);
+/* Value of a conversion while a command is encoded. */
+typedef struct redisFormatValue {
+  const char *str;
+  size_t len;
+  union {
+    int i;
+    long l;
+    long long ll;
+    double d;
+  };
+  char num[32];
+} redisFormatValue;
+
+static int redisFormatNum(char *buf, size_t size, const char *spec, int type,
+                          const redisFormatValue *v) {
+  switch (type) {
+  case REDIS_FMT_LONG:
+    return snprintf(buf, size, spec, v->l);
+  case REDIS_FMT_LONGLONG:
+    return snprintf(buf, size, spec, v->ll);
+  case REDIS_FMT_DOUBLE:
+    return snprintf(buf, size, spec, v->d);
+  default:
+    return snprintf(buf, size, spec, v->i);
   }
+}
 
-  /* Clear curarg because it was put in curargv or was free'd. */
-  curarg = nullptr;
+/* Print the value of the conversion tok into buf. */
+static int redisFormatTokenNum(char *buf, size_t size, const redisFormatToken *tok,
+                               const redisFormatValue *v) {
+  char spec[REDIS_FMT_SPEC_MAX + 1];
 
-  /* Add bytes needed to hold multi bulk count */
-  auto header = (size_t)1 + countDigits(argc) + 2;
-  if (totlen > SIZE_MAX - header)
-    goto memory_err;
-  totlen += header;
-  if (totlen > INT_MAX)
-    goto memory_err;
+  memcpy(spec, tok->text, tok->len);
+  spec[tok->len] = '\0';
+  return redisFormatNum(buf, size, spec, tok->type, v);
+}
 
-  /* Build the command at protocol level */
-  cmd = hi_malloc(totlen + 1);
-  if (cmd == nullptr)
-    goto memory_err;
+/* Double a scratch array that starts out on the stack. */
+static int redisGrowArray(void **array, void *stack, size_t size, int *cap) {
+  void *grown;
 
-  auto written = snprintf(cmd, totlen + 1, "*%d\r\n", argc);
-  if (written < 0 || (size_t)written > totlen) {
-    error_type = -2;
-    goto cleanup;
+  if (*array == stack) {
+    grown = hi_malloc(size * (size_t)*cap * 2);
+    if (grown != nullptr)
+      memcpy(grown, stack, size * (size_t)*cap);
+  } else {
+    grown = hi_realloc(*array, size * (size_t)*cap * 2);
   }
-  pos = (size_t)written;
-  for (j = 0; j < argc; j++) {
-    auto remaining = totlen - pos + 1;
-    written = snprintf(cmd + pos, remaining, "$%zu\r\n", sdslen(curargv[j]));
-    if (written < 0 || (size_t)written >= remaining) {
-      error_type = -2;
+  if (grown == nullptr)
+    return REDIS_ERR;
+  *array = grown;
+  *cap *= 2;
+  return REDIS_OK;
+}
+
+/* Where redisFormatWalk() writes a command: appended to *target when it is
+ * set, else into a new buffer stored in *buf. */
+typedef struct redisFormatSink {
+  sds *target;
+  char **buf;
+} redisFormatSink;
+
+/* Encode the command for format and ap into sink. Returns the encoded length,
+ * -1 when out of memory or -2 for an invalid format, in which case the sink
+ * is untouched.
+ *
+ * The format is walked twice. The first walk reads and measures the values
+ * (numbers are printed into a small buffer right away) and the arguments,
+ * the second one writes the command in place once its length is reserved. */
+static long long redisFormatWalk(redisFormatSink *sink, const char *format, va_list ap) {
+  constexpr int stack_slots = 16;
+  redisFormatValue stackvals[stack_slots];
+  size_t stacklens[stack_slots];
+  redisFormatValue *values = stackvals;
+  size_t *arglens = stacklens;
+  int valcap = stack_slots, argcap = stack_slots;
+  int nvalues = 0, argc = 0, touched = 0;
+  size_t cur = 0, totlen;
+  long long rv = -1;
+  redisFormatToken tok;
+  const char *c;
+  int kind;
+
+  c = format;
+  while ((kind = redisFormatNext(&c, &tok)) != REDIS_FMT_TOK_END) {
+    if (kind == REDIS_FMT_TOK_SPACE) {
+      if (touched) {
+        if (argc == argcap && redisGrowArray((void **)&arglens, stacklens, sizeof(*arglens),
+                                             &argcap) != REDIS_OK)
+          goto cleanup;
+        arglens[argc++] = cur;
+        cur = 0;
+        touched = 0;
+      }
+      continue;
+    }
+
+    touched = 1;
+    if (kind == REDIS_FMT_TOK_TEXT) {
+      cur += tok.len;
+      continue;
+    }
+    if (kind == REDIS_FMT_TOK_BAD) {
+      rv = -2;
       goto cleanup;
     }
-    pos += (size_t)written;
-    memcpy(cmd + pos, curargv[j], sdslen(curargv[j]));
-    pos += sdslen(curargv[j]);
-    sdsfree(curargv[j]);
-    cmd[pos++] = '\r';
-    cmd[pos++] = '\n';
+
+    if (nvalues == valcap &&
+        redisGrowArray((void **)&values, stackvals, sizeof(*values), &valcap) != REDIS_OK)
+      goto cleanup;
+    redisFormatValue *v = &values[nvalues++];
+
+    if (kind == REDIS_FMT_TOK_STR) {
+      v->str = va_arg(ap, const char *);
+      v->len = strlen(v->str);
+    } else if (kind == REDIS_FMT_TOK_BIN) {
+      v->str = va_arg(ap, const char *);
+      v->len = va_arg(ap, size_t);
+    } else {
+      if (tok.type == REDIS_FMT_LONG)
+        v->l = va_arg(ap, long);
+      else if (tok.type == REDIS_FMT_LONGLONG)
+        v->ll = va_arg(ap, long long);
+      else if (tok.type == REDIS_FMT_DOUBLE)
+        v->d = va_arg(ap, double);
+      else
+        v->i = va_arg(ap, int); /* char and short get promoted to int */
+
+      v->len = 0;
+      if (tok.len > 0) {
+        int n = redisFormatTokenNum(v->num, sizeof(v->num), &tok, v);
+        if (n < 0)
+          goto cleanup;
+        v->len = (size_t)n;
+      }
+    }
+    if (v->len > SIZE_MAX - cur)
+      goto cleanup;
+    cur += v->len;
+  }
+  if (touched) {
+    if (argc == argcap &&
+        redisGrowArray((void **)&arglens, stacklens, sizeof(*arglens), &argcap) != REDIS_OK)
+      goto cleanup;
+    arglens[argc++] = cur;
   }
-  assert(pos == totlen);
-  cmd[pos] = '\0';
 
-  hi_free(curargv);
-  *target = cmd;
-  return (int)totlen;
+  totlen = 1 + countDigits(argc) + 2;
+  for (int j = 0; j < argc; j++) {
+    if (arglens[j] > SIZE_MAX / 2 - totlen)
+      goto cleanup;
+    totlen += bulklen(arglens[j]);
+  }
 
-format_err:
-  error_type = -2;
-  goto cleanup;
+  char *start;
+  if (sink->target != nullptr) {
+    sds s = sdsMakeRoomFor(*sink->target, totlen);
+    if (s == nullptr)
+      goto cleanup;
+    *sink->target = s;
+    start = s + sdslen(s);
+  } else if ((start = hi_malloc(totlen + 1)) == nullptr) {
+    goto cleanup;
+  }
+
+  /* Same walk, writing this time */
+  char *p = start;
+  const char *end = p + totlen + 1;
+  redisFormatValue *v = values;
+  int arg = 0;
+
+  touched = 0;
+  p += snprintf(p, (size_t)(end - p), "*%d\r\n", argc);
+  c = format;
+  while ((kind = redisFormatNext(&c, &tok)) != REDIS_FMT_TOK_END) {
+    if (kind == REDIS_FMT_TOK_SPACE) {
+      if (touched) {
+        *p++ = '\r';
+        *p++ = '\n';
+        touched = 0;
+      }
+      continue;
+    }
 
-memory_err:
-  error_type = -1;
-  goto cleanup;
+    if (!touched)
+      p += snprintf(p, (size_t)(end - p), "$%zu\r\n", arglens[arg++]);
+    touched = 1;
+    if (kind == REDIS_FMT_TOK_TEXT) {
+      memcpy(p, tok.text, tok.len);
+      p += tok.len;
+      continue;
+    }
 
-cleanup:
-  if (curargv) {
-    while (argc--)
-      sdsfree(curargv[argc]);
-    hi_free(curargv);
+    if (kind != REDIS_FMT_TOK_NUM)
+      memcpy(p, v->str, v->len);
+    else if (v->len < sizeof(v->num))
+      memcpy(p, v->num, v->len);
+    else
+      redisFormatTokenNum(p, v->len + 1, &tok, v);
+    p += v->len;
+    v++;
+  }
+  if (touched) {
+    *p++ = '\r';
+    *p++ = '\n';
   }
 
-  sdsfree(curarg);
-  hi_free(cmd);
+  assert((size_t)(p - start) == totlen);
+  if (sink->target != nullptr) {
+    sdsIncrLen(*sink->target, (ssize_t)totlen);
+  } else {
+    *p = '\0';
+    *sink->buf = start;
+  }
+  rv = (long long)totlen;
+
+cleanup:
+  if (values != stackvals)
+    hi_free(values);
+  if (arglens != stacklens)
+    hi_free(arglens);
+  return rv;
+}
 
-  return error_type;
+int redisvFormatCommand(char **target, const char *format, va_list ap) {
+  char *cmd;
+
+  /* Abort if there is not target to set */
+  if (target == nullptr)
+    return -1;
+
+  auto len = redisFormatWalk(&(redisFormatSink){.buf = &cmd}, format, ap);
+  if (len < 0)
+    return (int)len;
+  if (len > INT_MAX) {
+    hi_free(cmd);
+    return -1;
+  }
+  *target = cmd;
+  return (int)len;
 }
 
 /* Format a command according to the Redis protocol. This function
@@ -601,6 +886,355 @@ int redisFormatCommand(char **target, const char *format, ...) {
   return len;
 }
 
+/* A command template is a list of operations over a text with the constant
+ * parts of the command. Arguments without conversions are stored complete
+ * with their "$<len>\r\n" header, as is the multi bulk count, so a template
+ * like "HINCRBY %s %s %lld" encodes as one copy of "*4\r\n$7\r\nHINCRBY\r\n"
+ * followed by three variable arguments. */
+enum {
+  REDIS_TPL_TEXT, /* Copy len bytes of text at off */
+  REDIS_TPL_ARG,  /* Header of variable argument number off, with len literal bytes */
+  REDIS_TPL_STR,  /* %s */
+  REDIS_TPL_BIN,  /* %b */
+  REDIS_TPL_NUM,  /* printf conversion, spec at off in text (none if len is 0) */
+};
+
+typedef struct redisTemplateOp {
+  int kind;
+  int type; /* REDIS_FMT_* for REDIS_TPL_NUM */
+  size_t off;
+  size_t len;
+} redisTemplateOp;
+
+struct redisCommandTemplate {
+  sds text;
+  redisTemplateOp *ops;
+  size_t nops;
+  int argc;
+  int nvars;   /* Arguments with conversions */
+  int nvalues; /* Conversions */
+  size_t name; /* Offset of the command name in text, or SIZE_MAX */
+  size_t namelen;
+};
+
+static int redisTemplatePush(redisCommandTemplate *t, int kind, int type, size_t off, size_t len) {
+  /* Extend the previous text operation when the bytes follow it */
+  if (kind == REDIS_TPL_TEXT && t->nops > 0) {
+    redisTemplateOp *last = &t->ops[t->nops - 1];
+    if (last->kind == REDIS_TPL_TEXT && last->off + last->len == off) {
+      last->len += len;
+      return REDIS_OK;
+    }
+  }
+
+  redisTemplateOp *ops = hi_realloc(t->ops, sizeof(*ops) * (t->nops + 1));
+  if (ops == nullptr)
+    return REDIS_ERR;
+  t->ops = ops;
+  t->ops[t->nops++] = (redisTemplateOp){.kind = kind, .type = type, .off = off, .len = len};
+  return REDIS_OK;
+}
+
+/* Close the argument whose operations start at ops[first] and text at
+ * text[start]. A constant argument is rewritten into a single piece of text
+ * that includes its header. */
+static int redisTemplateEndArg(redisCommandTemplate *t, size_t first, size_t start,
+                               int variable, size_t literal) {
+  sds text;
+
+  if (variable) {
+    t->ops[first].len = literal;
+    text = sdscatlen(t->text, "\r\n", 2);
+    if (text == nullptr)
+      return REDIS_ERR;
+    t->text = text;
+    t->argc++;
+    return redisTemplatePush(t, REDIS_TPL_TEXT, 0, sdslen(t->text) - 2, 2);
+  }
+
+  size_t len = sdslen(t->text) - start;
+  char hdr[32];
+  int hdrlen = snprintf(hdr, sizeof(hdr), "$%zu\r\n", len);
+
+  text = sdsMakeRoomFor(t->text, (size_t)hdrlen + 2);
+  if (text == nullptr)
+    return REDIS_ERR;
+  t->text = text;
+  memmove(t->text + start + hdrlen, t->text + start, len);
+  memcpy(t->text + start, hdr, (size_t)hdrlen);
+  memcpy(t->text + start + hdrlen + len, "\r\n", 2);
+  sdsIncrLen(t->text, hdrlen + 2);
+
+  if (t->argc == 0) {
+    t->name = start + (size_t)hdrlen;
+    t->namelen = len;
+  }
+  t->argc++;
+
+  /* Drop the placeholder header and the literal pieces of the argument */
+  t->nops = first;
+  return redisTemplatePush(t, REDIS_TPL_TEXT, 0, start, sdslen(t->text) - start);
+}
+
+redisCommandTemplate *redisCreateCommandTemplate(const char *format) {
+  const char *c = format;
+  size_t first = 0, start = 0, literal = 0;
+  int touched = 0, variable = 0;
+
+  redisCommandTemplate *t = hi_calloc(1, sizeof(*t));
+  if (t == nullptr)
+    return nullptr;
+  t->name = SIZE_MAX;
+  t->text = sdsempty();
+  if (t->text == nullptr)
+    goto error;
+
+  /* Arguments are split by the tokenizer of redisvFormatCommand() */
+  redisFormatToken tok;
+  int kind;
+  while ((kind = redisFormatNext(&c, &tok)) != REDIS_FMT_TOK_END) {
+    if (kind == REDIS_FMT_TOK_SPACE) {
+      if (touched) {
+        if (redisTemplateEndArg(t, first, start, variable, literal) != REDIS_OK)
+          goto error;
+        touched = 0;
+      }
+      continue;
+    }
+    if (kind == REDIS_FMT_TOK_BAD)
+      goto error;
+
+    if (!touched) {
+      first = t->nops;
+      start = sdslen(t->text);
+      variable = 0;
+      literal = 0;
+      if (redisTemplatePush(t, REDIS_TPL_ARG, 0, (size_t)t->nvars, 0) != REDIS_OK)
+        goto error;
+      touched = 1;
+    }
+
+    if (kind == REDIS_FMT_TOK_TEXT) {
+      sds text = sdscatlen(t->text, tok.text, tok.len);
+      if (text == nullptr)
+        goto error;
+      t->text = text;
+      if (redisTemplatePush(t, REDIS_TPL_TEXT, 0, sdslen(t->text) - tok.len, tok.len) != REDIS_OK)
+        goto error;
+      literal += tok.len;
+      continue;
+    }
+
+    if (!variable)
+      t->nvars++;
+    variable = 1;
+    t->nvalues++;
+    if (kind == REDIS_FMT_TOK_NUM) {
+      /* Specs too long to be printed have no text */
+      size_t off = 0;
+      if (tok.len > 0) {
+        off = sdslen(t->text);
+        sds text = sdscatlen(t->text, tok.text, tok.len);
+        if (text == nullptr || (text = sdscatlen(text, "", 1)) == nullptr)
+          goto error;
+        t->text = text;
+      }
+      if (redisTemplatePush(t, REDIS_TPL_NUM, tok.type, off, tok.len) != REDIS_OK)
+        goto error;
+    } else if (redisTemplatePush(t, kind == REDIS_FMT_TOK_STR ? REDIS_TPL_STR : REDIS_TPL_BIN, 0,
+                                 0, 0) != REDIS_OK) {
+      goto error;
+    }
+  }
+
+  if (touched && redisTemplateEndArg(t, first, start, variable, literal) != REDIS_OK)
+    goto error;
+
+  /* Prepend the multi bulk count */
+  char hdr[32];
+  int hdrlen = snprintf(hdr, sizeof(hdr), "*%d\r\n", t->argc);
+  sds text = sdsMakeRoomFor(t->text, (size_t)hdrlen);
+  if (text == nullptr)
+    goto error;
+  t->text = text;
+  memmove(t->text + hdrlen, t->text, sdslen(t->text));
+  memcpy(t->text, hdr, (size_t)hdrlen);
+  sdsIncrLen(t->text, hdrlen);
+  for (size_t i = 0; i < t->nops; i++) {
+    if (t->ops[i].kind == REDIS_TPL_TEXT || (t->ops[i].kind == REDIS_TPL_NUM && t->ops[i].len))
+      t->ops[i].off += (size_t)hdrlen;
+  }
+  if (t->name != SIZE_MAX)
+    t->name += (size_t)hdrlen;
+  if (t->nops > 0 && t->ops[0].kind == REDIS_TPL_TEXT && t->ops[0].off == (size_t)hdrlen) {
+    t->ops[0].off = 0;
+    t->ops[0].len += (size_t)hdrlen;
+  } else {
+    if (redisTemplatePush(t, REDIS_TPL_TEXT, 0, 0, 0) != REDIS_OK)
+      goto error;
+    memmove(t->ops + 1, t->ops, sizeof(*t->ops) * (t->nops - 1));
+    t->ops[0] = (redisTemplateOp){.kind = REDIS_TPL_TEXT, .off = 0, .len = (size_t)hdrlen};
+  }
+
+  return t;
+
+error:
+  redisFreeCommandTemplate(t);
+  return nullptr;
+}
+
+void redisFreeCommandTemplate(redisCommandTemplate *t) {
+  if (t == nullptr)
+    return;
+  sdsfree(t->text);
+  hi_free(t->ops);
+  hi_free(t);
+}
+
+const char *__redisTemplateName(const redisCommandTemplate *t, size_t *len) {
+  if (t->name == SIZE_MAX)
+    return nullptr;
+  *len = t->namelen;
+  return t->text + t->name;
+}
+
+/* Append the command for the values in ap to *target. The values are read
+ * and measured in a first pass, so the command is written with a single
+ * allocation and no intermediate copies. */
+int __redisTemplateCat(sds *target, const redisCommandTemplate *t, va_list ap) {
+  constexpr int stack_values = 8;
+  redisFormatValue stackvals[stack_values];
+  size_t stacklens[stack_values];
+  redisFormatValue *values = stackvals;
+  size_t *arglens = stacklens;
+  size_t totlen = 0, *arglen = nullptr;
+  int rv = REDIS_ERR;
+  int j = 0;
+
+  if (t->nvalues > stack_values || t->nvars > stack_values) {
+    values = hi_malloc(sizeof(*values) * (size_t)t->nvalues);
+    arglens = hi_malloc(sizeof(*arglens) * (size_t)t->nvars);
+    if (values == nullptr || arglens == nullptr)
+      goto cleanup;
+  }
+
+  /* Read the values and size everything */
+  for (size_t i = 0; i < t->nops; i++) {
+    const redisTemplateOp *op = &t->ops[i];
+    redisFormatValue *v = &values[j];
+    size_t len;
+
+    switch (op->kind) {
+    case REDIS_TPL_TEXT:
+      len = op->len;
+      break;
+    case REDIS_TPL_ARG:
+      arglen = &arglens[op->off];
+      *arglen = op->len;
+      continue;
+    case REDIS_TPL_STR:
+      v->str = va_arg(ap, const char *);
+      len = v->len = strlen(v->str);
+      j++;
+      break;
+    case REDIS_TPL_BIN:
+      v->str = va_arg(ap, const char *);
+      len = v->len = va_arg(ap, size_t);
+      j++;
+      break;
+    default:
+      if (op->type == REDIS_FMT_LONG)
+        v->l = va_arg(ap, long);
+      else if (op->type == REDIS_FMT_LONGLONG)
+        v->ll = va_arg(ap, long long);
+      else if (op->type == REDIS_FMT_DOUBLE)
+        v->d = va_arg(ap, double);
+      else
+        v->i = va_arg(ap, int);
+      v->len = 0;
+      if (op->len > 0) {
+        int n = redisFormatNum(v->num, sizeof(v->num), t->text + op->off, op->type, v);
+        if (n < 0)
+          goto cleanup;
+        v->len = (size_t)n;
+      }
+      len = v->len;
+      j++;
+      break;
+    }
+
+    if (totlen > SIZE_MAX - len)
+      goto cleanup;
+    totlen += len;
+    if (arglen != nullptr && op->kind != REDIS_TPL_TEXT)
+      *arglen += len;
+  }
+
+  /* Headers of the variable arguments */
+  for (int k = 0; k < t->nvars; k++) {
+    size_t hdr = 1 + countDigits(arglens[k]) + 2;
+    if (totlen > SIZE_MAX - hdr)
+      goto cleanup;
+    totlen += hdr;
+  }
+
+  sds s = sdsMakeRoomFor(*target, totlen);
+  if (s == nullptr)
+    goto cleanup;
+  *target = s;
+
+  /* Write the command */
+  char *p = s + sdslen(s);
+  const char *end = p + totlen + 1;
+  j = 0;
+  for (size_t i = 0; i < t->nops; i++) {
+    const redisTemplateOp *op = &t->ops[i];
+    redisFormatValue *v = &values[j];
+
+    switch (op->kind) {
+    case REDIS_TPL_TEXT:
+      memcpy(p, t->text + op->off, op->len);
+      p += op->len;
+      break;
+    case REDIS_TPL_ARG:
+      p += snprintf(p, (size_t)(end - p), "$%zu\r\n", arglens[op->off]);
+      break;
+    case REDIS_TPL_STR:
+    case REDIS_TPL_BIN:
+      memcpy(p, v->str, v->len);
+      p += v->len;
+      j++;
+      break;
+    default:
+      if (v->len < sizeof(v->num))
+        memcpy(p, v->num, v->len);
+      else
+        redisFormatNum(p, v->len + 1, t->text + op->off, op->type, v);
+      p += v->len;
+      j++;
+      break;
+    }
+  }
+
+  assert((size_t)(p - s) == sdslen(s) + totlen);
+  sdsIncrLen(s, (ssize_t)totlen);
+  rv = REDIS_OK;
+
+cleanup:
+  if (values != stackvals)
+    hi_free(values);
+  if (arglens != stacklens)
+    hi_free(arglens);
+  return rv;
+}
+
+/* Append the command for format and ap to *target, as redisvFormatCommand()
+ * would format it. Returns the encoded length, -1 when out of memory or -2
+ * for an invalid format, in which case *target is unchanged. */
+long long __redisFormatCat(sds *target, const char *format, va_list ap) {
+  return redisFormatWalk(&(redisFormatSink){.target = target}, format, ap);
+}
+
 /* Format a command according to the Redis protocol using an sds string and
  * sdscatfmt for the processing of arguments. This function takes the
  * number of arguments, an array with arguments and an array with their
@@ -653,27 +1287,122 @@ long long redisFormatSdsCommandArgv(sds *target, int argc, const char **argv,
   return totlen;
 }
 
-void redisFreeSdsCommand(sds cmd) {
-  sdsfree(cmd);
+/* Byte length of a typed argument, or -1 on an unknown type or overflow. */
+static long long redisArgLength(const redisArg *arg) {
+  size_t width;
+
+  if (arg->type == REDIS_ARG_BUFFER)
+    width = 1;
+  else if (arg->type == REDIS_ARG_FLOAT32)
+    width = sizeof(float);
+  else if (arg->type == REDIS_ARG_FLOAT64)
+    width = sizeof(double);
+  else
+    return -1;
+
+  if (arg->count > (size_t)LLONG_MAX / width)
+    return -1;
+  return (long long)(arg->count * width);
 }
 
-/* Format a command according to the Redis protocol. This function takes the
- * number of arguments, an array with arguments and an array with their
- * lengths. If the latter is set to nullptr, strlen will be used to compute the
- * argument lengths.
- */
-long long redisFormatCommandArgv(char **target, int argc, const char **argv,
-                                 const size_t *argvlen) {
-  char *cmd = nullptr; /* final command */
-  size_t pos;          /* position in final command */
-  size_t len, totlen;
-  int j;
+/* Append the argument payload as little endian, which on little endian hosts
+ * is a plain copy of the array. */
+static void redisArgEncode(char *dst, const redisArg *arg, size_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  size_t width = arg->type == REDIS_ARG_FLOAT32   ? sizeof(float)
+                 : arg->type == REDIS_ARG_FLOAT64 ? sizeof(double)
+                                                  : 1;
+  const char *src = arg->data;
+  for (size_t i = 0; i < len; i += width) {
+    for (size_t b = 0; b < width; b++)
+      dst[i + b] = src[i + width - 1 - b];
+  }
+#else
+  memcpy(dst, arg->data, len);
+#endif
+}
 
-  /* Abort on a nullptr target */
-  if (target == nullptr)
-    return -1;
+/* Append the command for typed arguments to *target. Returns the encoded
+ * length, -1 when out of memory or -2 for an argument of unknown type. */
+long long __redisArgsCat(sds *target, int argc, const redisArg *args) {
+  unsigned long long totlen;
+  long long len;
+  int j;
 
-  /* Calculate number of bytes needed for the command */
+  /* Calculate our total size */
+  totlen = 1 + countDigits(argc) + 2;
+  for (j = 0; j < argc; j++) {
+    if ((len = redisArgLength(&args[j])) < 0)
+      return -2;
+    totlen += bulklen(len);
+  }
+
+  sds s = sdsMakeRoomFor(*target, totlen);
+  if (s == nullptr)
+    return -1;
+  *target = s;
+
+  /* Construct command, the payloads are written in place */
+  char *p = s + sdslen(s);
+  const char *end = p + totlen + 1;
+  p += snprintf(p, (size_t)(end - p), "*%d\r\n", argc);
+  for (j = 0; j < argc; j++) {
+    len = redisArgLength(&args[j]);
+    p += snprintf(p, (size_t)(end - p), "$%lld\r\n", len);
+    redisArgEncode(p, &args[j], len);
+    p += len;
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+
+  assert((size_t)(p - s) == sdslen(s) + totlen);
+  sdsIncrLen(s, (ssize_t)totlen);
+  return totlen;
+}
+
+/* Format a command from typed arguments, see redisArg. Returns -1 when out of
+ * memory and -2 for an argument of unknown type. */
+long long redisFormatSdsCommandArgs(sds *target, int argc, const redisArg *args) {
+  long long len;
+  sds cmd;
+
+  /* Abort on a nullptr target */
+  if (target == nullptr)
+    return -1;
+
+  cmd = sdsempty();
+  if (cmd == nullptr)
+    return -1;
+  if ((len = __redisArgsCat(&cmd, argc, args)) < 0) {
+    sdsfree(cmd);
+    return len;
+  }
+
+  *target = cmd;
+  return len;
+}
+
+void redisFreeSdsCommand(sds cmd) {
+  sdsfree(cmd);
+}
+
+/* Format a command according to the Redis protocol. This function takes the
+ * number of arguments, an array with arguments and an array with their
+ * lengths. If the latter is set to nullptr, strlen will be used to compute the
+ * argument lengths.
+ */
+long long redisFormatCommandArgv(char **target, int argc, const char **argv,
+                                 const size_t *argvlen) {
+  char *cmd = nullptr; /* final command */
+  size_t pos;          /* position in final command */
+  size_t len, totlen;
+  int j;
+
+  /* Abort on a nullptr target */
+  if (target == nullptr)
+    return -1;
+
+  /* Calculate number of bytes needed for the command */
   totlen = 1 + countDigits(argc) + 2;
   for (j = 0; j < argc; j++) {
     len = argvlen ? argvlen[j] : strlen(argv[j]);
@@ -740,6 +1469,8 @@ static void redisPushAutoFree([[maybe_unused]] void *privdata, void *reply) {
   freeReplyObject(reply);
 }
 
+static void redisOutputReset(redisContext *c);
+
 static redisContext *redisContextInit() {
   redisContext *c;
 
@@ -752,6 +1483,7 @@ static redisContext *redisContextInit() {
   c->obuf = sdsempty();
   c->reader = redisReaderCreate();
   c->fd = REDIS_INVALID_FD;
+  c->tofd.pipe[0] = c->tofd.pipe[1] = -1;
 
   if (c->obuf == nullptr || c->reader == nullptr) {
     redisFree(c);
@@ -769,14 +1501,17 @@ void redisFree(redisContext *c) {
     c->funcs->close(c);
   }
 
+  redisOutputReset(c);
   sdsfree(c->obuf);
   redisReaderFree(c->reader);
+  redisNetCloseToFd(c);
   hi_free(c->tcp.host);
   hi_free(c->tcp.source_addr);
   hi_free(c->unix_sock.path);
   hi_free(c->connect_timeout);
   hi_free(c->command_timeout);
   hi_free(c->saddr);
+  hi_free(c->addrs);
 
   if (c->privdata && c->free_privdata)
     c->free_privdata(c->privdata);
@@ -808,11 +1543,15 @@ int redisReconnect(redisContext *c) {
     c->funcs->close(c);
   }
 
+  redisOutputReset(c);
   sdsfree(c->obuf);
   redisReaderFree(c->reader);
 
   c->obuf = sdsempty();
   c->reader = redisReaderCreate();
+  c->tofd.active = false;
+  if (c->tofd.inpipe > 0)
+    redisNetCloseToFd(c);
 
   if (c->obuf == nullptr || c->reader == nullptr) {
     __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
@@ -836,6 +1575,13 @@ int redisReconnect(redisContext *c) {
     redisContextSetTimeout(c, *c->command_timeout);
   }
 
+  /* The new socket may not support zerocopy sends any more */
+  if (ret == REDIS_OK && c->zerocopy.threshold > 0 &&
+      redisSetZeroCopy(c, c->zerocopy.threshold) != REDIS_OK)
+    c->zerocopy.threshold = 0;
+  if (ret == REDIS_OK && c->busypoll.sockopt)
+    redisSetBusyPoll(c, c->busypoll.usec, true);
+
   return ret;
 }
 
@@ -865,6 +1611,18 @@ redisContext *redisConnectWithOptions(const redisOptions *options) {
   if (options->options & REDIS_OPT_SET_SOCK_CLOEXEC) {
     c->flags |= REDIS_OPT_SET_SOCK_CLOEXEC;
   }
+  if (options->options & REDIS_OPT_TCP_CORK) {
+    c->flags |= REDIS_TCP_CORK;
+  }
+  if (options->options & REDIS_OPT_INLINE_WRITE) {
+    c->flags |= REDIS_INLINE_WRITE;
+  }
+  if (options->options & REDIS_OPT_ASYNC_DNS) {
+    c->flags |= REDIS_ASYNC_DNS;
+  }
+  if (options->options & REDIS_OPT_SHARED_DNS_CACHE) {
+    c->flags |= REDIS_SHARED_DNS_CACHE;
+  }
 
   /* Set any user supplied RESP3 PUSH handler or use freeReplyObject
    * as a default unless specifically flagged that we don't want one. */
@@ -990,6 +1748,14 @@ int redisSetTcpUserTimeout(redisContext *c, unsigned int timeout) {
   return redisContextSetTcpUserTimeout(c, timeout);
 }
 
+int redisEnableZeroCopy(redisContext *c, size_t threshold) {
+  return redisSetZeroCopy(c, threshold);
+}
+
+int redisEnableBusyPoll(redisContext *c, unsigned int usec, bool sockopt) {
+  return redisSetBusyPoll(c, usec, sockopt);
+}
+
 /* Set a user provided RESP3 PUSH handler and return any old one set. */
 redisPushFn *redisSetPushCallback(redisContext *c, redisPushFn *fn) {
   redisPushFn *old = c->push_cb;
@@ -1002,6 +1768,14 @@ redisPushFn *redisSetPushCallback(redisContext *c, redisPushFn *fn) {
  *
  * After this function is called, you may use redisGetReplyFromReader to
  * see if there is a reply available. */
+/* Note whether a read of want bytes that returned nread found the socket
+ * drained, see REDIS_READ_DRAINED. Only a plain socket returns everything
+ * there is, TLS hands out a record at a time. */
+static void __redisReadDrained(redisContext *c, ssize_t nread, size_t want) {
+  if (nread == 0 || ((size_t)nread < want && c->funcs->read == redisNetRead))
+    c->flags |= REDIS_READ_DRAINED;
+}
+
 int redisBufferRead(redisContext *c) {
   constexpr size_t buf_size = 16 * 1'024;
   char buf[buf_size];
@@ -1010,11 +1784,39 @@ int redisBufferRead(redisContext *c) {
   /* Return early when the context has seen an error. */
   if (c->err)
     return REDIS_ERR;
+  c->flags &= ~REDIS_READ_DRAINED;
+
+  /* Move the payload of a GET straight to its descriptor, see redisGetToFd().
+   * It only stops short of the payload when the socket would block. */
+  if (c->tofd.active && (c->tofd.left > 0 || c->tofd.inpipe > 0) &&
+      c->reader->pos == c->reader->len) {
+    auto moved = redisNetReadToFd(c, c->tofd.left);
+    if (moved < 0)
+      return REDIS_ERR;
+    if ((size_t)moved < c->tofd.left)
+      c->flags |= REDIS_READ_DRAINED;
+    c->tofd.left -= (size_t)moved;
+    return REDIS_OK;
+  }
+
+  /* Receive the payload of a mapped bulk string in place. */
+  size_t bulkavail;
+  char *bulk = redisReaderBulkBuffer(c->reader, &bulkavail);
+  if (bulk != nullptr) {
+    size_t want = bulkavail < INT_MAX ? bulkavail : INT_MAX;
+    nread = c->funcs->read(c, bulk, want);
+    if (nread < 0)
+      return REDIS_ERR;
+    __redisReadDrained(c, nread, want);
+    redisReaderBulkWritten(c->reader, (size_t)nread);
+    return REDIS_OK;
+  }
 
   nread = c->funcs->read(c, buf, sizeof(buf));
   if (nread < 0) {
     return REDIS_ERR;
   }
+  __redisReadDrained(c, nread, sizeof(buf));
   if (nread > 0 && redisReaderFeed(c->reader, buf, nread) != REDIS_OK) {
     __redisSetError(c, c->reader->err, c->reader->errstr);
     return REDIS_ERR;
@@ -1022,6 +1824,270 @@ int redisBufferRead(redisContext *c) {
   return REDIS_OK;
 }
 
+/* Written bytes at the start of obuf are only reclaimed past this size. */
+static constexpr size_t REDIS_OUTBUF_COMPACT = 64 * 1'024;
+
+/* An emptied obuf keeps its allocation for the next pipeline. Its size is
+ * compared with a high water mark of the recent pipelines that decays by
+ * 1/REDIS_OUTBUF_DECAY per drain, and the buffer is only reallocated once it
+ * is REDIS_OUTBUF_SHRINK times larger than that, never below
+ * REDIS_OUTBUF_KEEP. A burst is thereby followed by a few drains at the
+ * old size rather than a realloc on every one. */
+static constexpr size_t REDIS_OUTBUF_KEEP = 16 * 1'024;
+static constexpr size_t REDIS_OUTBUF_DECAY = 8;
+static constexpr size_t REDIS_OUTBUF_SHRINK = 4;
+
+/* Release a ref that was written or dropped and report it to its owner. */
+static void redisOutRefFinish(redisOutRef *r, int status) {
+  if (r->flags & REDIS_OUTREF_OWNED)
+    hi_free((void *)r->data);
+  if (r->done != nullptr)
+    r->done(r->privdata, status);
+  hi_free(r);
+}
+
+/* Empty obuf once all of it was written. */
+static void redisOutputDrained(redisContext *c) {
+  size_t used = sdslen(c->obuf);
+  size_t hiwat = c->out.hiwat;
+
+  hiwat = used > hiwat ? used : hiwat - hiwat / REDIS_OUTBUF_DECAY;
+  c->out.hiwat = hiwat;
+  c->out.pos = 0;
+
+  size_t keep = hiwat > REDIS_OUTBUF_KEEP ? hiwat : REDIS_OUTBUF_KEEP;
+  if (sdsalloc(c->obuf) / REDIS_OUTBUF_SHRINK > keep) {
+    /* Keeping the old buffer is fine when this fails */
+    sds s = sdsnewlen(nullptr, keep);
+    if (s != nullptr) {
+      sdsfree(c->obuf);
+      c->obuf = s;
+    }
+  }
+  sdsclear(c->obuf);
+}
+
+/* Finish a ref that was written completely. Refs sent with MSG_ZEROCOPY are
+ * held until the kernel is done with them, and so is every ref after them so
+ * that written callbacks keep their order. */
+static void redisOutRefRetire(redisContext *c, redisOutRef *r) {
+  if (!(r->flags & REDIS_OUTREF_ZEROCOPY) && c->zerocopy.head == nullptr) {
+    redisOutRefFinish(r, REDIS_OK);
+    return;
+  }
+
+  r->next = nullptr;
+  if (c->zerocopy.tail != nullptr)
+    c->zerocopy.tail->next = r;
+  else
+    c->zerocopy.head = r;
+  c->zerocopy.tail = r;
+}
+
+void redisOutputZeroCopyDone(redisContext *c) {
+  redisOutRef *r;
+
+  /* Completions of TCP zerocopy sends are reported in order */
+  while ((r = c->zerocopy.head) != nullptr) {
+    if ((r->flags & REDIS_OUTREF_ZEROCOPY) &&
+        (uint32_t)(c->zerocopy.completed - r->zcseq - 1) >= 0x8000'0000u)
+      break;
+    c->zerocopy.head = r->next;
+    if (c->zerocopy.head == nullptr)
+      c->zerocopy.tail = nullptr;
+    redisOutRefFinish(r, REDIS_OK);
+  }
+}
+
+/* Drop everything that is queued for output. */
+static void redisOutputReset(redisContext *c) {
+  redisOutRef *lists[] = {c->zerocopy.head, c->out.head};
+
+  /* Sequence numbers start over on a new socket */
+  c->zerocopy.head = c->zerocopy.tail = nullptr;
+  c->zerocopy.next = c->zerocopy.completed = 0;
+  c->out.head = c->out.tail = nullptr;
+  c->out.reflen = 0;
+  c->out.pos = 0;
+  c->out.hiwat = 0;
+  c->build.argc = 0;
+  for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+    redisOutRef *r = lists[i];
+    while (r != nullptr) {
+      redisOutRef *next = r->next;
+      redisOutRefFinish(r, REDIS_ERR);
+      r = next;
+    }
+  }
+}
+
+/* Move the unsent part of obuf to its start once the sent prefix is at least
+ * as large as what is left, so the move is paid for by the bytes written. */
+int __redisOutputCompact(redisContext *c) {
+  size_t pos = c->out.pos;
+
+  if (pos < REDIS_OUTBUF_COMPACT || pos * 2 < sdslen(c->obuf))
+    return REDIS_OK;
+  if (sdsrange(c->obuf, (ssize_t)pos, -1) < 0)
+    return REDIS_ERR;
+  for (redisOutRef *r = c->out.head; r != nullptr; r = r->next)
+    r->offset -= pos;
+  c->out.pos = 0;
+  return REDIS_OK;
+}
+
+/* Queue len bytes at data to be written after what is in obuf right now. */
+static int redisOutputAppendRef(redisContext *c, const char *data, size_t len, int flags) {
+  redisOutRef *r = hi_calloc(1, sizeof(*r));
+  if (r == nullptr)
+    return REDIS_ERR;
+
+  r->offset = sdslen(c->obuf);
+  r->data = data;
+  r->len = len;
+  r->flags = flags;
+  if (c->out.tail != nullptr)
+    c->out.tail->next = r;
+  else
+    c->out.head = r;
+  c->out.tail = r;
+  c->out.reflen += len;
+  return REDIS_OK;
+}
+
+size_t redisOutputPending(const redisContext *c) {
+  return sdslen(c->obuf) - c->out.pos + c->out.reflen;
+}
+
+int redisOutputIov(const redisContext *c, struct iovec *iov, int iovcnt) {
+  redisOutRef *r;
+  size_t pos = c->out.pos;
+  int n = 0;
+
+  for (r = c->out.head; r != nullptr && n < iovcnt; r = r->next) {
+    if (r->offset > pos) {
+      iov[n].iov_base = c->obuf + pos;
+      iov[n].iov_len = r->offset - pos;
+      pos = r->offset;
+      if (++n == iovcnt)
+        return n;
+    }
+    if (r->len > r->sent && (r->flags & REDIS_OUTREF_FILE)) {
+      /* Written by redisOutputFile() users, on their own */
+      return n;
+    }
+    if (r->len > r->sent) {
+      iov[n].iov_base = (void *)(r->data + r->sent);
+      iov[n].iov_len = r->len - r->sent;
+      n++;
+    }
+  }
+
+  if (r == nullptr && n < iovcnt && sdslen(c->obuf) > pos) {
+    iov[n].iov_base = c->obuf + pos;
+    iov[n].iov_len = sdslen(c->obuf) - pos;
+    n++;
+  }
+  return n;
+}
+
+redisOutRef *redisOutputFile(const redisContext *c) {
+  for (redisOutRef *r = c->out.head; r != nullptr; r = r->next) {
+    if (r->len > r->sent)
+      return r->offset == c->out.pos && (r->flags & REDIS_OUTREF_FILE) ? r : nullptr;
+  }
+  return nullptr;
+}
+
+/* Return the unsent part of the chunk of a file ref, reading the next chunk
+ * once the last one was sent. */
+static const char *redisOutputFileChunk(redisContext *c, redisOutRef *r, size_t *len) {
+  if (r->sent >= r->chunkoff + r->chunklen) {
+    size_t want = r->len - r->sent;
+    if (want > REDIS_OUTREF_CHUNK)
+      want = REDIS_OUTREF_CHUNK;
+
+    if (r->data == nullptr) {
+      r->data = hi_malloc(r->len < REDIS_OUTREF_CHUNK ? r->len : REDIS_OUTREF_CHUNK);
+      if (r->data == nullptr) {
+        __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+        return nullptr;
+      }
+      r->flags |= REDIS_OUTREF_OWNED;
+    }
+
+    ssize_t nread;
+    do
+      nread = pread(r->fd, (char *)r->data, want, (off_t)(r->fileoff + (long long)r->sent));
+    while (nread == -1 && errno == EINTR);
+    if (nread == -1) {
+      __redisSetError(c, REDIS_ERR_IO, strerror(errno));
+      return nullptr;
+    } else if (nread == 0) {
+      __redisSetError(c, REDIS_ERR_IO, "File argument ended before its length");
+      return nullptr;
+    }
+    r->chunkoff = r->sent;
+    r->chunklen = (size_t)nread;
+  }
+
+  *len = r->chunkoff + r->chunklen - r->sent;
+  return r->data + (r->sent - r->chunkoff);
+}
+
+const char *redisOutputPeek(redisContext *c, size_t *len) {
+  redisOutRef *r = c->out.head;
+
+  if (r != nullptr && r->offset == c->out.pos) {
+    if (r->flags & REDIS_OUTREF_FILE)
+      return redisOutputFileChunk(c, r, len);
+    *len = r->len - r->sent;
+    return r->data + r->sent;
+  }
+  *len = (r != nullptr ? r->offset : sdslen(c->obuf)) - c->out.pos;
+  return c->obuf + c->out.pos;
+}
+
+/* Mark len bytes of output as written. Nothing is moved here: the position
+ * in obuf and in the referenced buffers is advanced, and obuf is only
+ * emptied once all of it was written. Completion callbacks run from here
+ * and may append new commands. */
+int redisOutputConsume(redisContext *c, size_t len) {
+  for (;;) {
+    redisOutRef *r = c->out.head;
+
+    /* Finish refs written completely, including the data-less markers
+     * that are reached as soon as the bytes before them are written. */
+    if (r != nullptr && r->offset == c->out.pos && r->sent == r->len) {
+      c->out.head = r->next;
+      if (c->out.head == nullptr)
+        c->out.tail = nullptr;
+      redisOutRefRetire(c, r);
+      continue;
+    }
+    if (len == 0)
+      break;
+
+    size_t stop = r != nullptr ? r->offset : sdslen(c->obuf);
+    if (c->out.pos < stop) {
+      size_t n = stop - c->out.pos < len ? stop - c->out.pos : len;
+      c->out.pos += n;
+      len -= n;
+      continue;
+    }
+
+    assert(r != nullptr);
+    size_t n = r->len - r->sent < len ? r->len - r->sent : len;
+    r->sent += n;
+    c->out.reflen -= n;
+    len -= n;
+  }
+
+  if (c->out.head == nullptr && c->out.pos == sdslen(c->obuf) && c->out.pos > 0)
+    redisOutputDrained(c);
+  return REDIS_OK;
+}
+
 /* Write the output buffer to the socket.
  *
  * Returns REDIS_OK when the buffer is empty, or (a part of) the buffer was
@@ -1037,24 +2103,17 @@ int redisBufferWrite(redisContext *c, int *done) {
   if (c->err)
     return REDIS_ERR;
 
-  if (sdslen(c->obuf) > 0) {
+  if (redisOutputPending(c) > 0) {
     ssize_t nwritten = c->funcs->write(c);
     if (nwritten < 0) {
       return REDIS_ERR;
     } else if (nwritten > 0) {
-      if (nwritten == (ssize_t)sdslen(c->obuf)) {
-        sdsfree(c->obuf);
-        c->obuf = sdsempty();
-        if (c->obuf == nullptr)
-          goto oom;
-      } else {
-        if (sdsrange(c->obuf, nwritten, -1) < 0)
-          goto oom;
-      }
+      if (redisOutputConsume(c, (size_t)nwritten) != REDIS_OK)
+        goto oom;
     }
   }
   if (done != nullptr)
-    *done = (sdslen(c->obuf) == 0);
+    *done = (redisOutputPending(c) == 0);
   return REDIS_OK;
 
 oom:
@@ -1095,6 +2154,107 @@ static int redisNextInBandReplyFromReader(redisContext *c, void **reply) {
   return REDIS_OK;
 }
 
+/* Drop n bytes from the front of the reader buffer that were handled outside
+ * of the reader. */
+static void redisReaderConsume(redisReader *r, size_t n) {
+  r->pos += n;
+  if (r->pos == r->len) {
+    sdsclear(r->buf);
+    r->pos = r->len = 0;
+  }
+}
+
+/* Parse the length of a "$<len>\r\n" bulk header from the digits in p. */
+static bool redisParseBulkLen(const char *p, size_t len, long long *value) {
+  long long v = 0;
+
+  if (len == 0 || len > 18)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] < '0' || p[i] > '9')
+      return false;
+    v = v * 10 + (p[i] - '0');
+  }
+  *value = v;
+  return true;
+}
+
+/* Like getting the next in-band reply from the reader, except that the
+ * payload of a bulk string reply is written to fd, see redisGetToFd(). It is
+ * taken from the connection by redisBufferRead() while c->tofd is active. */
+int __redisGetReplyToFd(redisContext *c, int fd, void **reply) {
+  redisReader *r = c->reader;
+
+  *reply = nullptr;
+  while (!c->tofd.active) {
+    const char *p = r->buf + r->pos;
+    size_t avail = r->len - r->pos;
+    const char *nl;
+    long long len;
+
+    if (r->err == 0 && r->ridx == -1 && avail == 0)
+      return REDIS_OK;
+
+    /* Anything but a bulk string, nil and malformed headers included, goes
+     * through the reader */
+    if (r->err || r->ridx != -1 || p[0] != '$' ||
+        ((nl = memchr(p, '\n', avail)) != nullptr &&
+         (nl[-1] != '\r' || !redisParseBulkLen(p + 1, (size_t)(nl - p) - 2, &len)))) {
+      if (redisGetReplyFromReader(c, reply) == REDIS_ERR)
+        return REDIS_ERR;
+      if (redisHandledPushReply(c, *reply))
+        continue;
+      return REDIS_OK;
+    }
+    if (nl == nullptr)
+      return REDIS_OK;
+
+    redisReaderConsume(r, (size_t)(nl - p) + 1);
+    c->tofd.active = true;
+    c->tofd.fd = fd;
+    c->tofd.err = 0;
+    c->tofd.len = len;
+    c->tofd.left = (size_t)len;
+    c->tofd.splice = 0;
+  }
+
+  /* Bytes the reader already holds go first, those fd does not take yet stay
+   * there */
+  size_t n = r->len - r->pos < c->tofd.left ? r->len - r->pos : c->tofd.left;
+  if (n > 0) {
+    n = redisNetWriteToFd(c, r->buf + r->pos, n);
+    redisReaderConsume(r, n);
+    c->tofd.left -= n;
+  }
+  if (!redisNetFlushToFd(c) || c->tofd.left > 0 || r->len - r->pos < 2)
+    return REDIS_OK;
+
+  if (r->buf[r->pos] != '\r' || r->buf[r->pos + 1] != '\n') {
+    __redisSetError(c, REDIS_ERR_PROTOCOL, "Bad bulk string terminator");
+    return REDIS_ERR;
+  }
+  redisReaderConsume(r, 2);
+  c->tofd.active = false;
+
+  /* Built with the reader's functions, like any other reply */
+  redisReadTask task = {.type = REDIS_REPLY_INTEGER, .idx = -1, .privdata = r->privdata};
+  if (c->tofd.err == 0) {
+    *reply = r->fn && r->fn->createInteger ? r->fn->createInteger(&task, c->tofd.len)
+                                           : (void *)(uintptr_t)REDIS_REPLY_INTEGER;
+  } else {
+    char msg[128];
+    int len = snprintf(msg, sizeof(msg), "FDERR %s", strerror(c->tofd.err));
+    task.type = REDIS_REPLY_ERROR;
+    *reply = r->fn && r->fn->createString ? r->fn->createString(&task, msg, (size_t)len)
+                                          : (void *)(uintptr_t)REDIS_REPLY_ERROR;
+  }
+  if (*reply == nullptr) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+  }
+  return REDIS_OK;
+}
+
 int redisGetReply(redisContext *c, void **reply) {
   int wdone = 0;
   void *aux = nullptr;
@@ -1140,6 +2300,11 @@ int redisGetReply(redisContext *c, void **reply) {
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len) {
   sds newbuf;
 
+  if (__redisOutputCompact(c) != REDIS_OK) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+  }
+
   newbuf = sdscatlen(c->obuf, cmd, len);
   if (newbuf == nullptr) {
     __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
@@ -1150,6 +2315,100 @@ int __redisAppendCommand(redisContext *c, const char *cmd, size_t len) {
   return REDIS_OK;
 }
 
+/* Drop what was appended to the output queue since obuf was mark bytes long
+ * and tail the last reference. */
+void __redisOutputTruncate(redisContext *c, redisOutRef *tail, size_t mark) {
+  while (c->out.tail != tail) {
+    redisOutRef *r = tail != nullptr ? tail->next : c->out.head;
+    if (tail != nullptr)
+      tail->next = r->next;
+    else
+      c->out.head = r->next;
+    if (r == c->out.tail)
+      c->out.tail = tail;
+    c->out.reflen -= r->len;
+    if (r->flags & REDIS_OUTREF_OWNED)
+      hi_free((void *)r->data);
+    hi_free(r);
+  }
+  sdssetlen(c->obuf, mark);
+  c->obuf[mark] = '\0';
+}
+
+/* Append a command given as argv straight to the output queue. The protocol
+ * headers and small arguments are written into obuf, arguments of at least
+ * REDIS_OUTREF_MIN bytes are copied once into a buffer of their own that is
+ * written out with the rest by scatter-gather I/O. With a written callback
+ * those arguments are borrowed instead, and fn is called once the command
+ * was written. On failure nothing is appended. */
+int __redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen,
+                             redisWrittenFn *fn, void *privdata) {
+  size_t inlen, len;
+  int j;
+
+  if (__redisOutputCompact(c) != REDIS_OK)
+    goto oom;
+
+  /* Bytes that go into obuf */
+  inlen = 1 + countDigits(argc) + 2;
+  for (j = 0; j < argc; j++) {
+    len = argvlen ? argvlen[j] : strlen(argv[j]);
+    inlen += bulklen(len);
+    if (len >= REDIS_OUTREF_MIN)
+      inlen -= len;
+  }
+
+  sds newbuf = sdsMakeRoomFor(c->obuf, inlen);
+  if (newbuf == nullptr)
+    goto oom;
+  c->obuf = newbuf;
+
+  size_t mark = sdslen(c->obuf);
+  redisOutRef *tail = c->out.tail;
+  char *p = c->obuf + mark;
+
+  p += snprintf(p, inlen + 1, "*%d\r\n", argc);
+  for (j = 0; j < argc; j++) {
+    len = argvlen ? argvlen[j] : strlen(argv[j]);
+    p += snprintf(p, inlen + 1 - (size_t)(p - (c->obuf + mark)), "$%zu\r\n", len);
+    if (len >= REDIS_OUTREF_MIN && fn != nullptr) {
+      sdssetlen(c->obuf, (size_t)(p - c->obuf));
+      if (redisOutputAppendRef(c, argv[j], len, 0) != REDIS_OK)
+        goto rollback;
+    } else if (len >= REDIS_OUTREF_MIN) {
+      char *copy = hi_malloc(len);
+      sdssetlen(c->obuf, (size_t)(p - c->obuf));
+      if (copy == nullptr || redisOutputAppendRef(c, copy, len, REDIS_OUTREF_OWNED) != REDIS_OK) {
+        hi_free(copy);
+        goto rollback;
+      }
+      memcpy(copy, argv[j], len);
+    } else {
+      memcpy(p, argv[j], len);
+      p += len;
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+  sdssetlen(c->obuf, (size_t)(p - c->obuf));
+  c->obuf[sdslen(c->obuf)] = '\0';
+  assert(sdslen(c->obuf) - mark == inlen);
+
+  if (fn != nullptr) {
+    if (redisOutputAppendRef(c, nullptr, 0, 0) != REDIS_OK)
+      goto rollback;
+    c->out.tail->done = fn;
+    c->out.tail->privdata = privdata;
+  }
+  return REDIS_OK;
+
+rollback:
+  __redisOutputTruncate(c, tail, mark);
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+  return REDIS_ERR;
+}
+
 int redisAppendFormattedCommand(redisContext *c, const char *cmd, size_t len) {
 
   if (__redisAppendCommand(c, cmd, len) != REDIS_OK) {
@@ -1160,10 +2419,10 @@ int redisAppendFormattedCommand(redisContext *c, const char *cmd, size_t len) {
 }
 
 int redisvAppendCommand(redisContext *c, const char *format, va_list ap) {
-  char *cmd;
-  int len;
+  long long len = -1;
 
-  len = redisvFormatCommand(&cmd, format, ap);
+  if (__redisOutputCompact(c) == REDIS_OK)
+    len = __redisFormatCat(&c->obuf, format, ap);
   if (len == -1) {
     __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
     return REDIS_ERR;
@@ -1172,12 +2431,6 @@ int redisvAppendCommand(redisContext *c, const char *format, va_list ap) {
     return REDIS_ERR;
   }
 
-  if (__redisAppendCommand(c, cmd, len) != REDIS_OK) {
-    hi_free(cmd);
-    return REDIS_ERR;
-  }
-
-  hi_free(cmd);
   return REDIS_OK;
 }
 
@@ -1191,22 +2444,282 @@ int redisAppendCommand(redisContext *c, const char *format, ...) {
   return ret;
 }
 
+int redisvAppendTemplate(redisContext *c, const redisCommandTemplate *t, va_list ap) {
+  if (__redisOutputCompact(c) != REDIS_OK || __redisTemplateCat(&c->obuf, t, ap) != REDIS_OK) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+  }
+  return REDIS_OK;
+}
+
+int redisAppendTemplate(redisContext *c, const redisCommandTemplate *t, ...) {
+  va_list ap;
+  int ret;
+
+  va_start(ap, t);
+  ret = redisvAppendTemplate(c, t, ap);
+  va_end(ap);
+  return ret;
+}
+
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
-  sds cmd;
+  return __redisAppendCommandArgv(c, argc, argv, argvlen, nullptr, nullptr);
+}
+
+int redisAppendCommandArgvBorrowed(redisContext *c, int argc, const char **argv,
+                                   const size_t *argvlen, redisWrittenFn *fn, void *privdata) {
+  if (fn == nullptr) {
+    __redisSetError(c, REDIS_ERR_OTHER, "A written callback is required");
+    return REDIS_ERR;
+  }
+  return __redisAppendCommandArgv(c, argc, argv, argvlen, fn, privdata);
+}
+
+/* Call fn once everything appended so far was written. */
+int __redisAppendWritten(redisContext *c, redisWrittenFn *fn, void *privdata) {
+  if (redisOutputAppendRef(c, nullptr, 0, 0) != REDIS_OK) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+  }
+  c->out.tail->done = fn;
+  c->out.tail->privdata = privdata;
+  return REDIS_OK;
+}
+
+/* Append a command with file arguments, which are queued by reference. */
+static int redisAppendCommandFileArgs(redisContext *c, int argc, const redisArg *args) {
+  size_t inlen;
   long long len;
+  int j;
+
+  if (__redisOutputCompact(c) != REDIS_OK)
+    goto oom;
+
+  /* Bytes that go into obuf */
+  inlen = 1 + countDigits(argc) + 2;
+  for (j = 0; j < argc; j++) {
+    if (args[j].type == REDIS_ARG_FILE) {
+      if (args[j].fd < 0 || args[j].offset < 0) {
+        __redisSetError(c, REDIS_ERR_OTHER, "Invalid file argument");
+        return REDIS_ERR;
+      }
+      inlen += bulklen(args[j].count) - args[j].count;
+    } else if ((len = redisArgLength(&args[j])) >= 0) {
+      inlen += bulklen(len);
+    } else {
+      __redisSetError(c, REDIS_ERR_OTHER, "Invalid argument type");
+      return REDIS_ERR;
+    }
+  }
+
+  sds newbuf = sdsMakeRoomFor(c->obuf, inlen);
+  if (newbuf == nullptr)
+    goto oom;
+  c->obuf = newbuf;
+
+  size_t mark = sdslen(c->obuf);
+  redisOutRef *tail = c->out.tail;
+  char *p = c->obuf + mark;
 
-  len = redisFormatSdsCommandArgv(&cmd, argc, argv, argvlen);
+  p += snprintf(p, inlen + 1, "*%d\r\n", argc);
+  for (j = 0; j < argc; j++) {
+    const redisArg *arg = &args[j];
+    size_t avail = inlen + 1 - (size_t)(p - (c->obuf + mark));
+    if (arg->type == REDIS_ARG_FILE) {
+      p += snprintf(p, avail, "$%zu\r\n", arg->count);
+      sdssetlen(c->obuf, (size_t)(p - c->obuf));
+      if (redisOutputAppendRef(c, nullptr, arg->count, REDIS_OUTREF_FILE) != REDIS_OK) {
+        __redisOutputTruncate(c, tail, mark);
+        goto oom;
+      }
+      c->out.tail->fd = arg->fd;
+      c->out.tail->fileoff = arg->offset;
+    } else {
+      len = redisArgLength(arg);
+      p += snprintf(p, avail, "$%lld\r\n", len);
+      redisArgEncode(p, arg, (size_t)len);
+      p += len;
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+  sdssetlen(c->obuf, (size_t)(p - c->obuf));
+  c->obuf[sdslen(c->obuf)] = '\0';
+  assert(sdslen(c->obuf) - mark == inlen);
+  return REDIS_OK;
+
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+  return REDIS_ERR;
+}
+
+int redisAppendCommandArgs(redisContext *c, int argc, const redisArg *args) {
+  long long len = -1;
+
+  for (int j = 0; j < argc; j++) {
+    if (args[j].type == REDIS_ARG_FILE)
+      return redisAppendCommandFileArgs(c, argc, args);
+  }
+
+  if (__redisOutputCompact(c) == REDIS_OK)
+    len = __redisArgsCat(&c->obuf, argc, args);
   if (len == -1) {
     __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
     return REDIS_ERR;
+  } else if (len == -2) {
+    __redisSetError(c, REDIS_ERR_OTHER, "Invalid argument type");
+    return REDIS_ERR;
   }
 
-  if (__redisAppendCommand(c, cmd, len) != REDIS_OK) {
-    sdsfree(cmd);
+  return REDIS_OK;
+}
+
+/* Drop the command being built and end the build. */
+void redisCommandAbort(redisContext *c) {
+  if (c->build.argc == 0)
+    return;
+  sdssetlen(c->obuf, c->build.mark);
+  c->obuf[c->build.mark] = '\0';
+  c->build.argc = 0;
+}
+
+static int redisCommandFail(redisContext *c, int type, const char *str) {
+  redisCommandAbort(c);
+  __redisSetError(c, type, str);
+  return REDIS_ERR;
+}
+
+int redisCommandBegin(redisContext *c, int argc) {
+  if (c->build.argc != 0)
+    return redisCommandFail(c, REDIS_ERR_OTHER, "A command is already being built");
+  if (argc < 1)
+    return redisCommandFail(c, REDIS_ERR_OTHER, "A command needs at least one argument");
+  if (__redisOutputCompact(c) != REDIS_OK)
+    return redisCommandFail(c, REDIS_ERR_OOM, "Out of memory");
+
+  auto digits = countDigits((uint64_t)argc);
+  sds newbuf = sdsMakeRoomFor(c->obuf, 1 + digits + 2);
+  if (newbuf == nullptr)
+    return redisCommandFail(c, REDIS_ERR_OOM, "Out of memory");
+  c->obuf = newbuf;
+
+  c->build.mark = sdslen(c->obuf);
+  c->build.argc = argc;
+  c->build.added = 0;
+
+  char *p = c->obuf + c->build.mark;
+  *p++ = '*';
+  p = redisWriteDecimal(p, (uint64_t)argc, digits);
+  *p++ = '\r';
+  *p++ = '\n';
+  sdssetlen(c->obuf, (size_t)(p - c->obuf));
+  return REDIS_OK;
+}
+
+/* Write the header of the next argument of len bytes and return where its
+ * payload goes, with room for the trailing CRLF. nullptr on failure. */
+static char *redisCommandArgStart(redisContext *c, size_t len) {
+  if (c->build.argc == 0) {
+    __redisSetError(c, REDIS_ERR_OTHER, "No command is being built");
+    return nullptr;
+  }
+  if (c->build.added == c->build.argc) {
+    redisCommandFail(c, REDIS_ERR_OTHER, "More arguments than announced");
+    return nullptr;
+  }
+
+  auto digits = countDigits(len);
+  sds newbuf = sdsMakeRoomFor(c->obuf, 1 + digits + 2 + len + 2);
+  if (newbuf == nullptr) {
+    redisCommandFail(c, REDIS_ERR_OOM, "Out of memory");
+    return nullptr;
+  }
+  c->obuf = newbuf;
+
+  char *p = c->obuf + sdslen(c->obuf);
+  *p++ = '$';
+  p = redisWriteDecimal(p, len, digits);
+  *p++ = '\r';
+  *p++ = '\n';
+  return p;
+}
+
+/* Close the argument whose payload ends at p. */
+static int redisCommandArgEnd(redisContext *c, char *p) {
+  *p++ = '\r';
+  *p++ = '\n';
+  *p = '\0';
+  sdssetlen(c->obuf, (size_t)(p - c->obuf));
+  c->build.added++;
+  return REDIS_OK;
+}
+
+int redisCommandAddBinary(redisContext *c, const void *buf, size_t len) {
+  char *p = redisCommandArgStart(c, len);
+  if (p == nullptr)
+    return REDIS_ERR;
+  if (len > 0)
+    memcpy(p, buf, len);
+  return redisCommandArgEnd(c, p + len);
+}
+
+int redisCommandAddString(redisContext *c, const char *str) {
+  return redisCommandAddBinary(c, str, strlen(str));
+}
+
+int redisCommandAddInt64(redisContext *c, int64_t value) {
+  uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  auto digits = countDigits(v);
+
+  char *p = redisCommandArgStart(c, (value < 0) + digits);
+  if (p == nullptr)
     return REDIS_ERR;
+  if (value < 0)
+    *p++ = '-';
+  return redisCommandArgEnd(c, redisWriteDecimal(p, v, digits));
+}
+
+/* Print v with the fewest significant digits that strtod() reads back as v.
+ * %g drops trailing zeros, so when 15 digits read back they are the shortest
+ * form for all but subnormals; otherwise 16 or 17 (always enough) are used. */
+static int redisFormatDouble(char *buf, size_t size, double v) {
+  int len = 0;
+
+  for (int precision = 15; precision <= 17; precision++) {
+    len = snprintf(buf, size, "%.*g", precision, v);
+    if (strtod(buf, nullptr) == v)
+      break;
   }
+  return len;
+}
 
-  sdsfree(cmd);
+int redisCommandAddDouble(redisContext *c, double value) {
+  char buf[32];
+  int len;
+
+  if (value != value)
+    return redisCommandFail(c, REDIS_ERR_OTHER, "NaN is not a valid argument");
+
+  /* Integral values, the common case, skip printf altogether. Negative zero
+   * is not one of them, it has to be sent as -0. */
+  if (value >= -0x1p53 && value <= 0x1p53 && (double)(int64_t)value == value &&
+      !(value == 0 && signbit(value)))
+    return redisCommandAddInt64(c, (int64_t)value);
+
+  /* Infinities come out as inf and -inf, which Redis accepts */
+  len = redisFormatDouble(buf, sizeof(buf), value);
+  return redisCommandAddBinary(c, buf, (size_t)len);
+}
+
+/* End the build, leaving the command appended to the output buffer. */
+int redisCommandFinish(redisContext *c) {
+  if (c->build.argc == 0) {
+    __redisSetError(c, REDIS_ERR_OTHER, "No command is being built");
+    return REDIS_ERR;
+  }
+  if (c->build.added != c->build.argc)
+    return redisCommandFail(c, REDIS_ERR_OTHER, "Fewer arguments than announced");
+  c->build.argc = 0;
   return REDIS_OK;
 }
 
@@ -1251,3 +2764,215 @@ void *redisCommandArgv(redisContext *c, int argc, const char **argv, const size_
     return nullptr;
   return __redisBlockForReply(c);
 }
+
+void *redisCommandArgs(redisContext *c, int argc, const redisArg *args) {
+  if (redisAppendCommandArgs(c, argc, args) != REDIS_OK)
+    return nullptr;
+  return __redisBlockForReply(c);
+}
+
+/* The command timeout in milliseconds for poll(), -1 without one. */
+static long redisCommandTimeoutMsec(const redisContext *c) {
+  constexpr long milliseconds_per_second = 1'000;
+  constexpr long microseconds_per_millisecond = 1'000;
+  constexpr long round_up_usec = 999;
+
+  if (c->command_timeout == nullptr)
+    return -1;
+  long msec = c->command_timeout->tv_sec * milliseconds_per_second +
+              (c->command_timeout->tv_usec + round_up_usec) / microseconds_per_millisecond;
+  if (msec < 0 || msec > INT_MAX)
+    msec = INT_MAX;
+  return msec;
+}
+
+void *redisGetToFd(redisContext *c, const char *key, size_t keylen, int fd) {
+  const char *argv[] = {"GET", key};
+  const size_t argvlen[] = {3, keylen};
+  void *reply = nullptr;
+  int wdone = 0;
+
+  if (!(c->flags & REDIS_BLOCK)) {
+    __redisSetError(c, REDIS_ERR_OTHER, "redisGetToFd needs a blocking context");
+    return nullptr;
+  }
+  if (redisAppendCommandArgv(c, 2, argv, argvlen) != REDIS_OK)
+    return nullptr;
+
+  do {
+    if (redisBufferWrite(c, &wdone) == REDIS_ERR)
+      return nullptr;
+  } while (!wdone);
+
+  for (;;) {
+    if (__redisGetReplyToFd(c, fd, &reply) == REDIS_ERR)
+      return nullptr;
+    if (reply != nullptr)
+      return reply;
+
+    /* Wait here rather than in redisBufferRead() while fd is full, for as
+     * long as the socket would be waited for */
+    if (c->tofd.inpipe > 0) {
+      struct pollfd wfd = {.fd = fd, .events = POLLOUT};
+      auto n = poll(&wfd, 1, (int)redisCommandTimeoutMsec(c));
+      if (n == 0) {
+        __redisSetError(c, REDIS_ERR_TIMEOUT, "Descriptor write timeout");
+        return nullptr;
+      }
+      if (n == -1 && errno != EINTR) {
+        __redisSetError(c, REDIS_ERR_IO, strerror(errno));
+        return nullptr;
+      }
+      continue;
+    }
+    if (redisBufferRead(c) == REDIS_ERR)
+      return nullptr;
+  }
+}
+
+/* Commands appended by one feed call while they are in flight */
+typedef struct redisPipelineBatch {
+  size_t bytes;
+  int replies;
+} redisPipelineBatch;
+
+int redisPipeline(redisContext *c, redisPipelineFeedFn *feed, redisPipelineReplyFn *fn,
+                  void *privdata, size_t max_inflight) {
+  redisPipelineBatch *batches = nullptr;
+  size_t cap = 0, head = 0, count = 0, inflight = 0;
+  bool more = true;
+  int rv = REDIS_ERR;
+
+  if (!(c->flags & REDIS_BLOCK)) {
+    __redisSetError(c, REDIS_ERR_OTHER, "redisPipeline needs a blocking context");
+    return REDIS_ERR;
+  }
+  if (c->err)
+    return REDIS_ERR;
+  if (redisOutputPending(c) > 0) {
+    __redisSetError(c, REDIS_ERR_OTHER, "redisPipeline needs an empty output buffer");
+    return REDIS_ERR;
+  }
+  auto msec = redisCommandTimeoutMsec(c);
+
+  /* A plain socket goes nonblocking for the run, to be written and read as
+   * it allows */
+  auto duplex = c->funcs->read == redisNetRead && c->funcs->write == redisNetWrite;
+  if (duplex) {
+    if (redisContextSetBlocking(c, 0) != REDIS_OK)
+      return REDIS_ERR;
+    c->flags &= ~REDIS_BLOCK;
+  }
+
+  for (;;) {
+    /* Take commands while the budget allows, there is always room for one
+     * batch */
+    while (more && (inflight < max_inflight || count == 0)) {
+      auto before = redisOutputPending(c);
+      auto n = feed(c, privdata);
+      if (n < 0) {
+        if (!c->err)
+          __redisSetError(c, REDIS_ERR_OTHER, "Pipeline feed failed");
+        goto out;
+      } else if (n == 0) {
+        more = false;
+        break;
+      }
+
+      if (count == cap) {
+        auto newcap = cap ? cap * 2 : 16;
+        redisPipelineBatch *grown = hi_realloc(batches, newcap * sizeof(*grown));
+        if (grown == nullptr)
+          goto oom;
+        /* Unwrap the ring */
+        memcpy(grown + cap, grown, head * sizeof(*grown));
+        batches = grown;
+        cap = newcap;
+      }
+      auto bytes = redisOutputPending(c) - before;
+      batches[(head + count) % cap] = (redisPipelineBatch){.bytes = bytes, .replies = n};
+      count++;
+      inflight += bytes;
+    }
+
+    /* Hand over the replies that arrived */
+    while (count > 0) {
+      void *reply = nullptr;
+      if (redisNextInBandReplyFromReader(c, &reply) == REDIS_ERR)
+        goto out;
+      if (reply == nullptr)
+        break;
+
+      if (fn != nullptr) {
+        /* Replies to its commands would not be counted */
+        auto pending = redisOutputPending(c);
+        fn(c, reply, privdata);
+        if (redisOutputPending(c) != pending) {
+          __redisSetError(c, REDIS_ERR_OTHER, "Pipeline reply callback appended a command");
+          goto out;
+        }
+      } else {
+        freeReplyObject(reply);
+      }
+
+      if (--batches[head].replies == 0) {
+        inflight -= batches[head].bytes;
+        head = (head + 1) % cap;
+        count--;
+      }
+    }
+    if (count == 0 && !more) {
+      rv = REDIS_OK;
+      break;
+    }
+
+    if (duplex) {
+      bool readable, writable = redisOutputPending(c) > 0;
+      if (redisContextWaitIo(c, &readable, &writable, msec) != REDIS_OK)
+        goto out;
+      if (!readable && !writable) {
+        __redisSetError(c, REDIS_ERR_TIMEOUT, "Pipeline timeout");
+        goto out;
+      }
+      if (writable && redisBufferWrite(c, nullptr) == REDIS_ERR)
+        goto out;
+      if (readable && redisBufferRead(c) == REDIS_ERR)
+        goto out;
+    } else {
+      /* The budget keeps what is in flight from filling both sides */
+      int wdone = 0;
+      do {
+        if (redisBufferWrite(c, &wdone) == REDIS_ERR)
+          goto out;
+      } while (!wdone);
+      if (redisBufferRead(c) == REDIS_ERR)
+        goto out;
+    }
+  }
+  goto out;
+
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+out:
+  if (duplex) {
+    c->flags |= REDIS_BLOCK;
+    if (c->fd != REDIS_INVALID_FD && redisContextSetBlocking(c, 1) != REDIS_OK)
+      rv = REDIS_ERR;
+  }
+  hi_free(batches);
+  return rv;
+}
+
+void *redisvTemplateCommand(redisContext *c, const redisCommandTemplate *t, va_list ap) {
+  if (redisvAppendTemplate(c, t, ap) != REDIS_OK)
+    return nullptr;
+  return __redisBlockForReply(c);
+}
+
+void *redisTemplateCommand(redisContext *c, const redisCommandTemplate *t, ...) {
+  va_list ap;
+  va_start(ap, t);
+  void *reply = redisvTemplateCommand(c, t, ap);
+  va_end(ap);
+  return reply;
+}
@@ -32,12 +32,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* splice() and pipe2() */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,9 +51,14 @@
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
 
 #include "hiredis/net.h"
 #include "hiredis/alloc.h"
@@ -57,15 +68,110 @@ void __redisSetError(redisContext *c, int type, const char *str);
 
 int redisContextUpdateCommandTimeout(redisContext *c, const struct timeval *timeout);
 
+static void redisResolveCancel(redisContext *c);
+static int redisResolveFinish(redisContext *c);
+static void redisAddrsForget(redisContext *c);
+
 void redisNetClose(redisContext *c) {
+  if (c && c->resolve != nullptr)
+    redisResolveCancel(c);
   if (c && c->fd != REDIS_INVALID_FD) {
     close(c->fd);
     c->fd = REDIS_INVALID_FD;
   }
 }
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+/* Collect MSG_ZEROCOPY completions from the socket error queue. */
+static void redisNetReapZeroCopy(redisContext *c) {
+  char control[128];
+
+  for (;;) {
+    struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+    if (recvmsg(c->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+      break;
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+
+      struct sock_extended_err serr;
+      memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+      if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      /* Sends ee_info to ee_data completed */
+      c->zerocopy.completed = serr.ee_data + 1;
+      if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        c->zerocopy.copied += serr.ee_data - serr.ee_info + 1;
+    }
+  }
+
+  redisOutputZeroCopyDone(c);
+}
+
+/* Cut iov before the first ref large enough to be sent zerocopy, or down to
+ * that ref alone when it comes first, which is then returned. */
+static redisOutRef *redisNetZeroCopyCut(redisContext *c, struct iovec *iov, int *iovcnt) {
+  for (redisOutRef *r = c->out.head; r != nullptr; r = r->next) {
+    if (r->flags & REDIS_OUTREF_FILE)
+      break;
+    if (r->len - r->sent < c->zerocopy.threshold)
+      continue;
+    for (int i = 0; i < *iovcnt; i++) {
+      if (iov[i].iov_base == (void *)(r->data + r->sent)) {
+        *iovcnt = i > 0 ? i : 1;
+        return i > 0 ? nullptr : r;
+      }
+    }
+    break;
+  }
+  return nullptr;
+}
+#endif
+
+/* Receive without blocking until data arrives or busypoll.usec passed, then
+ * block. EOF and errors other than no data yet end the spin without counting
+ * as a hit or a fallback. */
+static ssize_t redisNetBusyRecv(redisContext *c, char *buf, size_t bufcap) {
+#ifdef MSG_DONTWAIT
+  constexpr long long microseconds_per_second = 1'000'000;
+  constexpr long long nanoseconds_per_microsecond = 1'000;
+  struct timespec now;
+  long long deadline = 0;
+
+  for (;;) {
+    auto nread = recv(c->fd, buf, bufcap, MSG_DONTWAIT);
+    if (nread > 0)
+      c->busypoll.hits++;
+    if (nread != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return nread;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    auto usec = now.tv_sec * microseconds_per_second + now.tv_nsec / nanoseconds_per_microsecond;
+    if (deadline == 0)
+      deadline = usec + c->busypoll.usec;
+    else if (usec >= deadline)
+      break;
+  }
+  c->busypoll.fallbacks++;
+#endif
+  return recv(c->fd, buf, bufcap, 0);
+}
+
 ssize_t redisNetRead(redisContext *c, char *buf, size_t bufcap) {
-  auto nread = recv(c->fd, buf, bufcap, 0);
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+  /* Completions make the socket poll as errored until they are read */
+  if (c->zerocopy.head != nullptr)
+    redisNetReapZeroCopy(c);
+#endif
+
+  ssize_t nread;
+  if (c->busypoll.usec > 0 && (c->flags & REDIS_BLOCK))
+    nread = redisNetBusyRecv(c, buf, bufcap);
+  else
+    nread = recv(c->fd, buf, bufcap, 0);
   if (nread == -1) {
     if ((errno == EWOULDBLOCK && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
       /* Try again later */
@@ -85,19 +191,337 @@ ssize_t redisNetRead(redisContext *c, char *buf, size_t bufcap) {
   }
 }
 
-ssize_t redisNetWrite(redisContext *c) {
-  auto nwritten = send(c->fd, c->obuf, sdslen(c->obuf), 0);
-  if (nwritten < 0) {
-    if ((errno == EWOULDBLOCK && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
-      /* Try again */
+/* Send from the file ref the output continues with. */
+static ssize_t redisNetWriteFile(redisContext *c, redisOutRef *r) {
+  ssize_t nwritten = -1;
+
+#ifdef __linux__
+  /* Straight from the page cache, unless the file can't be mapped */
+  size_t count = r->len - r->sent;
+  off_t off = (off_t)(r->fileoff + (long long)r->sent);
+  if (count > 0x7fff'f000)
+    count = 0x7fff'f000;
+  nwritten = sendfile(c->fd, r->fd, &off, count);
+  if (nwritten == 0) {
+    __redisSetError(c, REDIS_ERR_IO, "File argument ended before its length");
+    return -1;
+  }
+  if (nwritten == -1 && (errno == EINVAL || errno == ENOSYS))
+#endif
+  {
+    size_t len;
+    const char *buf = redisOutputPeek(c, &len);
+    if (buf == nullptr)
+      return -1;
+    nwritten = send(c->fd, buf, len, 0);
+  }
+
+  if (nwritten == -1) {
+    if ((errno == EWOULDBLOCK && !(c->flags & REDIS_BLOCK)) || (errno == EINTR))
       return 0;
+    __redisSetError(c, REDIS_ERR_IO, strerror(errno));
+    return -1;
+  }
+  return nwritten;
+}
+
+ssize_t redisNetWrite(redisContext *c) {
+  struct iovec iov[REDIS_IOV_MAX];
+  ssize_t nwritten;
+
+  int iovcnt = redisOutputIov(c, iov, REDIS_IOV_MAX);
+  if (iovcnt == 0) {
+    redisOutRef *r = redisOutputFile(c);
+    if (r != nullptr)
+      return redisNetWriteFile(c, r);
+  }
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+  if (c->zerocopy.threshold > 0) {
+    redisNetReapZeroCopy(c);
+
+    redisOutRef *zc = redisNetZeroCopyCut(c, iov, &iovcnt);
+    if (zc != nullptr) {
+      struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 1};
+      nwritten = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+      if (nwritten > 0) {
+        zc->flags |= REDIS_OUTREF_ZEROCOPY;
+        zc->zcseq = c->zerocopy.next++;
+        c->zerocopy.sends++;
+        return nwritten;
+      }
+      /* Out of optmem for pinned pages: copy this one */
+      if (errno != ENOBUFS)
+        goto error;
+    }
+    c->zerocopy.fallbacks++;
+  }
+#endif
+
+  if (iovcnt == 1) {
+    nwritten = send(c->fd, iov[0].iov_base, iov[0].iov_len, 0);
+  } else {
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)iovcnt};
+    nwritten = sendmsg(c->fd, &msg, 0);
+  }
+  if (nwritten < 0)
+    goto error;
+
+  return nwritten;
+
+error:
+  if ((errno == EWOULDBLOCK && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
+    /* Try again */
+    return 0;
+  } else {
+    __redisSetError(c, REDIS_ERR_IO, strerror(errno));
+    return -1;
+  }
+}
+
+/* Bytes copied through user space at a time. Until fd took a splice, no more
+ * than this waits in the pipe, so a copy out of it can put back what fd did
+ * not take without reordering the payload. */
+static constexpr size_t REDIS_TOFD_CHUNK = 16 * 1'024;
+
+/* Create the pipe of the context, unless it has one */
+static int redisNetToFdPipe(redisContext *c) {
+  int p[2];
+
+  if (c->tofd.pipe[0] != -1)
+    return REDIS_OK;
+#ifdef __linux__
+  if (pipe2(p, O_CLOEXEC | O_NONBLOCK) == -1)
+    return REDIS_ERR;
+  /* A larger pipe takes fewer round trips, the default is fine too */
+  auto cap = fcntl(p[1], F_SETPIPE_SZ, (int)REDIS_TOFD_PIPE);
+  if (cap <= 0)
+    cap = fcntl(p[1], F_GETPIPE_SZ);
+  c->tofd.pipecap = cap > 0 ? (size_t)cap : REDIS_TOFD_CHUNK;
+#else
+  if (pipe(p) == -1)
+    return REDIS_ERR;
+  for (int i = 0; i < 2; i++) {
+    if (fcntl(p[i], F_SETFD, FD_CLOEXEC) == -1 || fcntl(p[i], F_SETFL, O_NONBLOCK) == -1) {
+      close(p[0]);
+      close(p[1]);
+      return REDIS_ERR;
+    }
+  }
+  c->tofd.pipecap = REDIS_TOFD_CHUNK;
+#endif
+  c->tofd.pipe[0] = p[0];
+  c->tofd.pipe[1] = p[1];
+  return REDIS_OK;
+}
+
+void redisNetCloseToFd(redisContext *c) {
+  if (c->tofd.pipe[0] == -1)
+    return;
+  close(c->tofd.pipe[0]);
+  close(c->tofd.pipe[1]);
+  c->tofd.pipe[0] = c->tofd.pipe[1] = -1;
+  c->tofd.inpipe = 0;
+}
+
+/* Copy what waits in the pipe to fd, putting back what it does not take */
+static bool redisNetCopyOutToFd(redisContext *c) {
+  char buf[REDIS_TOFD_CHUNK];
+  size_t want = c->tofd.inpipe < sizeof(buf) ? c->tofd.inpipe : sizeof(buf);
+
+  auto nread = read(c->tofd.pipe[0], buf, want);
+  if (nread <= 0) {
+    if (nread == -1 && errno == EINTR)
+      return true;
+    c->tofd.err = nread == -1 ? errno : EIO;
+    redisNetCloseToFd(c);
+    return true;
+  }
+  c->tofd.inpipe -= (size_t)nread;
+
+  for (size_t off = 0; off < (size_t)nread;) {
+    auto n = write(c->tofd.fd, buf + off, (size_t)nread - off);
+    if (n > 0) {
+      off += (size_t)n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      /* The pipe held no more than this, so it goes back in order */
+      auto back = write(c->tofd.pipe[1], buf + off, (size_t)nread - off);
+      if (back != (ssize_t)((size_t)nread - off)) {
+        c->tofd.err = ENOBUFS;
+        return true;
+      }
+      c->tofd.inpipe += (size_t)back;
+      return false;
     } else {
+      c->tofd.err = n == -1 ? errno : EIO;
+      return true;
+    }
+  }
+  return true;
+}
+
+bool redisNetFlushToFd(redisContext *c) {
+  char buf[REDIS_TOFD_CHUNK];
+
+  while (c->tofd.inpipe > 0) {
+    /* Discard the rest once writing failed */
+    if (c->tofd.err != 0) {
+      auto n = read(c->tofd.pipe[0], buf, sizeof(buf));
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        redisNetCloseToFd(c);
+        break;
+      }
+      c->tofd.inpipe -= (size_t)n < c->tofd.inpipe ? (size_t)n : c->tofd.inpipe;
+      continue;
+    }
+
+#ifdef __linux__
+    if (c->tofd.splice >= 0) {
+      auto n = splice(c->tofd.pipe[0], nullptr, c->tofd.fd, nullptr, c->tofd.inpipe, SPLICE_F_MOVE);
+      if (n > 0) {
+        c->tofd.inpipe -= (size_t)n;
+        c->tofd.splice = 1;
+      } else if (n == -1 && errno == EINTR) {
+        continue;
+      } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+      } else if (n == -1 && errno == EINVAL && c->tofd.splice == 0) {
+        c->tofd.splice = -1; /* fd can't be spliced to, e.g. opened with O_APPEND */
+      } else {
+        c->tofd.err = n == -1 ? errno : EIO;
+      }
+      continue;
+    }
+#endif
+    if (!redisNetCopyOutToFd(c))
+      return false;
+  }
+  return true;
+}
+
+size_t redisNetWriteToFd(redisContext *c, const char *buf, size_t len) {
+  size_t taken = 0;
+
+  if (!redisNetFlushToFd(c))
+    return 0;
+  if (c->tofd.err != 0)
+    return len;
+
+  while (taken < len) {
+    auto n = write(c->tofd.fd, buf + taken, len - taken);
+    if (n > 0) {
+      taken += (size_t)n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      c->tofd.err = n == -1 ? errno : EIO;
+      return len;
+    }
+  }
+  if (taken == len)
+    return len;
+
+  /* Keep up to a buffer of the rest for the next time */
+  if (redisNetToFdPipe(c) != REDIS_OK) {
+    c->tofd.err = errno;
+    return len;
+  }
+  size_t want = len - taken < REDIS_TOFD_CHUNK ? len - taken : REDIS_TOFD_CHUNK;
+  for (;;) {
+    auto n = write(c->tofd.pipe[1], buf + taken, want);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n > 0) {
+      c->tofd.inpipe += (size_t)n;
+      taken += (size_t)n;
+    }
+    return taken;
+  }
+}
+
+#ifdef __linux__
+/* Splice the payload from the socket to fd through the pipe, so it never
+ * enters user space. Returns the bytes taken from the socket, or -1 with the
+ * error set in the context or with *fallback set when splice() can't be used
+ * on this socket. */
+static ssize_t redisNetSpliceToFd(redisContext *c, size_t len, int *fallback) {
+  size_t total = 0;
+
+  if (redisNetToFdPipe(c) != REDIS_OK) {
+    *fallback = 1;
+    return -1;
+  }
+
+  /* The pipe is empty here, and only taken from again once emptied */
+  while (total < len && c->tofd.inpipe == 0) {
+    size_t room = c->tofd.splice > 0 ? c->tofd.pipecap : REDIS_TOFD_CHUNK;
+    size_t want = len - total < room ? len - total : room;
+    unsigned int more = want < len - total ? SPLICE_F_MORE : 0;
+    auto n = splice(c->fd, nullptr, c->tofd.pipe[1], nullptr, want, SPLICE_F_MOVE | more);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EWOULDBLOCK && !(c->flags & REDIS_BLOCK))
+        break;
+      if (total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+        *fallback = 1;
+        return -1;
+      }
       __redisSetError(c, REDIS_ERR_IO, strerror(errno));
       return -1;
+    } else if (n == 0) {
+      __redisSetError(c, REDIS_ERR_EOF, "Server closed the connection");
+      return -1;
     }
+    total += (size_t)n;
+    c->tofd.inpipe += (size_t)n;
+    redisNetFlushToFd(c);
   }
+  return (ssize_t)total;
+}
+#endif
 
-  return nwritten;
+ssize_t redisNetReadToFd(redisContext *c, size_t len) {
+  char buf[REDIS_TOFD_CHUNK];
+  ssize_t total = 0;
+
+  /* Nothing more is taken while fd is full */
+  if (!redisNetFlushToFd(c))
+    return 0;
+
+#ifdef __linux__
+  /* Plain sockets only, a TLS payload has to be decrypted in user space */
+  if (c->funcs->read == redisNetRead && c->tofd.err == 0 && c->tofd.splice >= 0) {
+    int fallback = 0;
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    if (c->zerocopy.head != nullptr)
+      redisNetReapZeroCopy(c);
+#endif
+    total = redisNetSpliceToFd(c, len, &fallback);
+    if (total >= 0 || !fallback)
+      return total;
+    total = 0;
+  }
+#endif
+
+  while ((size_t)total < len && c->tofd.inpipe == 0) {
+    size_t want = len - (size_t)total;
+    auto nread = c->funcs->read(c, buf, want < sizeof(buf) ? want : sizeof(buf));
+    if (nread < 0)
+      return -1;
+    if (nread == 0)
+      break;
+    /* All of it is taken, what fd refuses fits the emptied pipe */
+    redisNetWriteToFd(c, buf, (size_t)nread);
+    total += nread;
+  }
+  return total;
 }
 
 static void __redisSetErrorFromErrno(redisContext *c, int type, const char *prefix) {
@@ -176,6 +600,29 @@ static int redisSetBlocking(redisContext *c, int blocking) {
   return REDIS_OK;
 }
 
+int redisContextSetBlocking(redisContext *c, int blocking) {
+  return redisSetBlocking(c, blocking);
+}
+
+int redisContextWaitIo(redisContext *c, bool *readable, bool *writable, long msec) {
+  struct pollfd pfd = {.fd = c->fd, .events = POLLIN};
+  int res;
+
+  if (*writable)
+    pfd.events |= POLLOUT;
+  while ((res = poll(&pfd, 1, msec)) == -1) {
+    if (errno != EINTR) {
+      __redisSetErrorFromErrno(c, REDIS_ERR_IO, "poll(2)");
+      return REDIS_ERR;
+    }
+  }
+
+  /* Errors and hangups are reported by the next read */
+  *readable = res > 0 && (pfd.revents & (POLLIN | POLLERR | POLLHUP));
+  *writable = res > 0 && (pfd.revents & POLLOUT);
+  return REDIS_OK;
+}
+
 int redisKeepAlive(redisContext *c, int interval) {
   int val = 1;
   redisFD fd = c->fd;
@@ -231,6 +678,21 @@ int redisSetTcpNoDelay(redisContext *c) {
   return REDIS_OK;
 }
 
+/* TCP_CORK (TCP_NOPUSH on the BSDs) holds back partial segments until it is
+ * cleared again. Failing to set it costs nothing but packets, so the
+ * connection is kept either way. */
+int redisSetTcpCork(redisContext *c, [[maybe_unused]] int on) {
+  if (c->connection_type != REDIS_CONN_TCP || c->fd == REDIS_INVALID_FD)
+    return REDIS_ERR;
+#if defined(TCP_CORK)
+  return setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1 ? REDIS_ERR : REDIS_OK;
+#elif defined(TCP_NOPUSH)
+  return setsockopt(c->fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on)) == -1 ? REDIS_ERR : REDIS_OK;
+#else
+  return REDIS_ERR;
+#endif
+}
+
 int redisContextSetTcpUserTimeout(redisContext *c, [[maybe_unused]] unsigned int timeout) {
   int res;
 #ifdef TCP_USER_TIMEOUT
@@ -247,6 +709,37 @@ int redisContextSetTcpUserTimeout(redisContext *c, [[maybe_unused]] unsigned int
   return REDIS_OK;
 }
 
+int redisSetZeroCopy(redisContext *c, size_t threshold) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+  int on = threshold > 0;
+  if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1)
+    return REDIS_ERR;
+  c->zerocopy.threshold = threshold;
+  return REDIS_OK;
+#else
+  (void)c;
+  (void)threshold;
+  return REDIS_ERR;
+#endif
+}
+
+int redisSetBusyPoll(redisContext *c, unsigned int usec, bool sockopt) {
+  sockopt = sockopt && usec > 0;
+  if (sockopt || c->busypoll.sockopt) {
+#ifdef SO_BUSY_POLL
+    int val = sockopt ? (usec > INT_MAX ? INT_MAX : (int)usec) : 0;
+    if (setsockopt(c->fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == -1 && sockopt)
+      return REDIS_ERR;
+#else
+    if (sockopt)
+      return REDIS_ERR;
+#endif
+  }
+  c->busypoll.usec = usec;
+  c->busypoll.sockopt = sockopt;
+  return REDIS_OK;
+}
+
 static constexpr long MAX_MSEC = (LONG_MAX - 999L) / 1'000L;
 
 static int redisContextTimeoutMsec(redisContext *c, long *result) {
@@ -324,6 +817,16 @@ static int redisContextWaitReady(redisContext *c, long msec) {
 }
 
 int redisCheckConnectDone(redisContext *c, int *completed) {
+  /* Connect once the address of a REDIS_OPT_ASYNC_DNS context is known */
+  if (c->resolve != nullptr) {
+    if (redisResolveFinish(c) != REDIS_OK)
+      return REDIS_ERR;
+    if (c->resolve != nullptr) {
+      *completed = 0;
+      return REDIS_OK;
+    }
+  }
+
   auto rc = connect(c->fd, (const struct sockaddr *)c->saddr, c->addrlen);
   if (rc == 0) {
     *completed = 1;
@@ -355,6 +858,7 @@ int redisCheckConnectDone(redisContext *c, int *completed) {
     *completed = 0;
     return REDIS_OK;
   default:
+    redisAddrsForget(c);
     return REDIS_ERR;
   }
 }
@@ -432,85 +936,274 @@ int redisContextUpdateCommandTimeout(redisContext *c, const struct timeval *time
   return REDIS_OK;
 }
 
-static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
-                                   const struct timeval *timeout, const char *source_addr) {
-  redisFD s;
-  int rv, n;
-  constexpr size_t port_buf_size = 6; /* strlen("65535"); */
-  char port_buf[port_buf_size];
-  struct addrinfo hints = {0};
-  struct addrinfo *servinfo, *bservinfo, *p, *b;
-  auto blocking = (c->flags & REDIS_BLOCK);
-  auto reuseaddr = (c->flags & REDIS_REUSEADDR);
-  int reuses = 0;
-  long timeout_msec = -1;
+/* Look up addr for a TCP connection. To use dual stack, set both flags to
+ * prefer both IPv4 and IPv6. By default, for historical reasons, we try IPv4
+ * first and then we try IPv6 only if no IPv4 address was found. Returns the
+ * getaddrinfo() result, hints is left at the family that was tried last. */
+static int redisLookupTcp(const char *addr, const char *port, int flags, struct addrinfo *hints,
+                          struct addrinfo **servinfo) {
+  hints->ai_socktype = SOCK_STREAM;
+  if (flags & REDIS_PREFER_IPV6 && flags & REDIS_PREFER_IPV4)
+    hints->ai_family = AF_UNSPEC;
+  else if (flags & REDIS_PREFER_IPV6)
+    hints->ai_family = AF_INET6;
+  else
+    hints->ai_family = AF_INET;
+
+  auto rv = getaddrinfo(addr, port, hints, servinfo);
+  if (rv != 0 && hints->ai_family != AF_UNSPEC) {
+    /* Try again with the other IP version. */
+    hints->ai_family = (hints->ai_family == AF_INET) ? AF_INET6 : AF_INET;
+    rv = getaddrinfo(addr, port, hints, servinfo);
+  }
+  return rv;
+}
+
+/* Bind s to the source address of the context, looked up with hints */
+static int redisBindSourceAddr(redisContext *c, redisFD s, const struct addrinfo *hints) {
+  struct addrinfo *bservinfo, *b;
+  int rv, n, bound = 0;
   constexpr size_t error_buf_size = 128;
 
-  servinfo = nullptr;
-  c->connection_type = REDIS_CONN_TCP;
-  c->tcp.port = port;
+  /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
+  if ((rv = getaddrinfo(c->tcp.source_addr, nullptr, hints, &bservinfo)) != 0) {
+    char buf[error_buf_size];
+    snprintf(buf, sizeof(buf), "Can't get addr: %s", gai_strerror(rv));
+    __redisSetError(c, REDIS_ERR_OTHER, buf);
+    return REDIS_ERR;
+  }
 
-  /* We need to take possession of the passed parameters
-   * to make them reusable for a reconnect.
-   * We also carefully check we don't free data we already own,
-   * as in the case of the reconnect method.
-   *
-   * This is a bit ugly, but atleast it works and doesn't leak memory.
-   **/
-  if (c->tcp.host != addr) {
-    hi_free(c->tcp.host);
+  if (c->flags & REDIS_REUSEADDR) {
+    n = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&n, sizeof(n)) < 0) {
+      freeaddrinfo(bservinfo);
+      __redisSetErrorFromErrno(c, REDIS_ERR_IO, "setsockopt(SO_REUSEADDR)");
+      return REDIS_ERR;
+    }
+  }
 
-    c->tcp.host = hi_strdup(addr);
-    if (c->tcp.host == nullptr)
-      goto oom;
+  for (b = bservinfo; b != nullptr; b = b->ai_next) {
+    if (bind(s, b->ai_addr, b->ai_addrlen) != -1) {
+      bound = 1;
+      break;
+    }
   }
+  freeaddrinfo(bservinfo);
+  if (!bound) {
+    char buf[error_buf_size];
+    snprintf(buf, sizeof(buf), "Can't bind socket: %s", strerror(errno));
+    __redisSetError(c, REDIS_ERR_OTHER, buf);
+    return REDIS_ERR;
+  }
+  return REDIS_OK;
+}
 
-  if (timeout) {
-    if (redisContextUpdateConnectTimeout(c, timeout) == REDIS_ERR)
-      goto oom;
-  } else {
-    hi_free(c->connect_timeout);
-    c->connect_timeout = nullptr;
+/* Order addresses the way RFC 8305 races them: the family getaddrinfo()
+ * put first leads, then the families take turns. */
+static void redisInterleaveAddrs(struct addrinfo *servinfo, struct addrinfo **order) {
+  struct addrinfo *same = servinfo, *other = servinfo;
+  auto family = servinfo->ai_family;
+  size_t n = 0;
+
+  for (bool turn = true; same != nullptr || other != nullptr; turn = !turn) {
+    while (same != nullptr && same->ai_family != family)
+      same = same->ai_next;
+    while (other != nullptr && other->ai_family == family)
+      other = other->ai_next;
+    struct addrinfo **next = (turn && same != nullptr) || other == nullptr ? &same : &other;
+    if (*next == nullptr)
+      break;
+    order[n++] = *next;
+    *next = (*next)->ai_next;
   }
+}
 
-  if (redisContextTimeoutMsec(c, &timeout_msec) != REDIS_OK) {
+/* Happy eyeballs (RFC 8305) for blocking contexts: a connect is started to
+ * the next address whenever the ones in flight failed or did not connect
+ * within REDIS_CONNECT_ATTEMPT_DELAY, the first to connect wins and the
+ * others are closed. The connect timeout bounds the whole race. */
+static int redisContextConnectRace(redisContext *c, struct addrinfo *servinfo,
+                                   const struct addrinfo *hints, long timeout_msec) {
+  struct addrinfo **order = nullptr, **pending = nullptr;
+  struct pollfd *pfds = nullptr;
+  size_t naddrs = 0, next = 0, inflight = 0;
+  int reuses = 0, lasterr = 0;
+  bool start = true;
+  redisFD winner = REDIS_INVALID_FD;
+  struct addrinfo *won = nullptr;
+  constexpr size_t error_buf_size = 128;
+
+  for (auto p = servinfo; p != nullptr; p = p->ai_next)
+    naddrs++;
+  order = hi_calloc(naddrs, sizeof(*order));
+  pending = hi_calloc(naddrs, sizeof(*pending));
+  pfds = hi_calloc(naddrs, sizeof(*pfds));
+  if (order == nullptr || pending == nullptr || pfds == nullptr) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
     goto error;
   }
+  redisInterleaveAddrs(servinfo, order);
+
+  auto end = timeout_msec >= 0 ? redisPollMillis() + timeout_msec : 0;
+  while (winner == REDIS_INVALID_FD) {
+    /* Start the next attempt */
+    if (start && next < naddrs) {
+      auto p = order[next++];
+      int sock_type = p->ai_socktype;
+#ifdef SOCK_CLOEXEC
+      if (c->flags & REDIS_OPT_SET_SOCK_CLOEXEC)
+        sock_type |= SOCK_CLOEXEC;
+#endif
+      redisFD s = socket(p->ai_family, sock_type, p->ai_protocol);
+      if (s == REDIS_INVALID_FD) {
+        lasterr = errno;
+        continue;
+      }
 
-  if (source_addr == nullptr) {
-    hi_free(c->tcp.source_addr);
-    c->tcp.source_addr = nullptr;
-  } else if (c->tcp.source_addr != source_addr) {
-    hi_free(c->tcp.source_addr);
-    c->tcp.source_addr = hi_strdup(source_addr);
-    if (c->tcp.source_addr == nullptr)
-      goto oom;
+      c->fd = s;
+      if (redisSetBlocking(c, 0) != REDIS_OK)
+        goto error;
+      c->fd = REDIS_INVALID_FD;
+      if (c->tcp.source_addr && redisBindSourceAddr(c, s, hints) != REDIS_OK) {
+        close(s);
+        goto error;
+      }
+
+      if (connect(s, p->ai_addr, p->ai_addrlen) == 0) {
+        winner = s;
+        won = p;
+        break;
+      } else if (errno == EINPROGRESS) {
+        pfds[inflight] = (struct pollfd){.fd = s, .events = POLLOUT};
+        pending[inflight++] = p;
+        start = false;
+      } else {
+        lasterr = errno;
+        close(s);
+        /* Try the same address again with another source port */
+        if (lasterr == EADDRNOTAVAIL && (c->flags & REDIS_REUSEADDR) &&
+            ++reuses < REDIS_CONNECT_RETRIES)
+          next--;
+        continue;
+      }
+    }
+
+    if (inflight == 0) {
+      if (next < naddrs) {
+        start = true;
+        continue;
+      }
+      break;
+    }
+
+    /* Wait for an attempt to finish, or until the next one is due */
+    long wait = next < naddrs ? REDIS_CONNECT_ATTEMPT_DELAY : -1;
+    if (timeout_msec >= 0) {
+      auto left = end - redisPollMillis();
+      if (left <= 0) {
+        lasterr = ETIMEDOUT;
+        break;
+      }
+      if (wait < 0 || left < wait)
+        wait = left;
+    }
+
+    if (wait > INT_MAX)
+      wait = INT_MAX;
+    auto res = poll(pfds, (nfds_t)inflight, (int)wait);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      __redisSetErrorFromErrno(c, REDIS_ERR_IO, "poll(2)");
+      goto error;
+    } else if (res == 0) {
+      start = true;
+      continue;
+    }
+
+    for (size_t i = 0; i < inflight;) {
+      if (pfds[i].revents == 0) {
+        i++;
+        continue;
+      }
+      int err = 0;
+      socklen_t errlen = sizeof(err);
+      if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+        err = errno;
+      if (err == 0) {
+        winner = pfds[i].fd;
+        won = pending[i];
+        pfds[i] = pfds[--inflight];
+        pending[i] = pending[inflight];
+        break;
+      }
+
+      /* Failed, the next address goes right away */
+      lasterr = err;
+      close(pfds[i].fd);
+      pfds[i] = pfds[--inflight];
+      pending[i] = pending[inflight];
+      start = true;
+    }
   }
 
-  snprintf(port_buf, sizeof(port_buf), "%d", port);
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-
-  /* DNS lookup. To use dual stack, set both flags to prefer both IPv4 and
-   * IPv6. By default, for historical reasons, we try IPv4 first and then we
-   * try IPv6 only if no IPv4 address was found. */
-  if (c->flags & REDIS_PREFER_IPV6 && c->flags & REDIS_PREFER_IPV4)
-    hints.ai_family = AF_UNSPEC;
-  else if (c->flags & REDIS_PREFER_IPV6)
-    hints.ai_family = AF_INET6;
-  else
-    hints.ai_family = AF_INET;
+  /* The losers */
+  for (size_t i = 0; i < inflight; i++)
+    close(pfds[i].fd);
+  inflight = 0;
 
-  rv = getaddrinfo(c->tcp.host, port_buf, &hints, &servinfo);
-  if (rv != 0 && hints.ai_family != AF_UNSPEC) {
-    /* Try again with the other IP version. */
-    hints.ai_family = (hints.ai_family == AF_INET) ? AF_INET6 : AF_INET;
-    rv = getaddrinfo(c->tcp.host, port_buf, &hints, &servinfo);
+  if (winner == REDIS_INVALID_FD) {
+    if (lasterr == 0) {
+      char buf[error_buf_size];
+      snprintf(buf, sizeof(buf), "Can't create socket: %s", strerror(errno));
+      __redisSetError(c, REDIS_ERR_OTHER, buf);
+    } else {
+      errno = lasterr;
+      __redisSetErrorFromErrno(c, REDIS_ERR_IO, nullptr);
+    }
+    goto error;
   }
-  if (rv != 0) {
-    __redisSetError(c, REDIS_ERR_OTHER, gai_strerror(rv));
-    return REDIS_ERR;
+
+  c->fd = winner;
+  /* For repeat connection */
+  hi_free(c->saddr);
+  c->saddr = hi_malloc(won->ai_addrlen);
+  if (c->saddr == nullptr) {
+    __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+    goto error;
   }
+  memcpy(c->saddr, won->ai_addr, won->ai_addrlen);
+  c->addrlen = won->ai_addrlen;
+
+  if (redisSetTcpNoDelay(c) != REDIS_OK || redisSetBlocking(c, 1) != REDIS_OK)
+    goto error;
+
+  hi_free(order);
+  hi_free(pending);
+  hi_free(pfds);
+  c->flags |= REDIS_CONNECTED;
+  return REDIS_OK;
+
+error:
+  for (size_t i = 0; i < inflight; i++)
+    close(pfds[i].fd);
+  hi_free(order);
+  hi_free(pending);
+  hi_free(pfds);
+  return REDIS_ERR;
+}
+
+/* Connect to the first address of servinfo that takes a socket. hints are the
+ * ones servinfo was looked up with, they are used for the source address. */
+static int redisContextConnectAddrs(redisContext *c, struct addrinfo *servinfo,
+                                    const struct addrinfo *hints, long timeout_msec) {
+  redisFD s;
+  struct addrinfo *p;
+  auto blocking = (c->flags & REDIS_BLOCK);
+  auto reuseaddr = (c->flags & REDIS_REUSEADDR);
+  int reuses = 0;
+  constexpr size_t error_buf_size = 128;
+
   for (p = servinfo; p != nullptr; p = p->ai_next) {
   addrretry: {
     int sock_type = p->ai_socktype;
@@ -529,38 +1222,8 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
 
     if (redisSetBlocking(c, 0) != REDIS_OK)
       goto error;
-    if (c->tcp.source_addr) {
-      int bound = 0;
-      /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
-      if ((rv = getaddrinfo(c->tcp.source_addr, nullptr, &hints, &bservinfo)) != 0) {
-        char buf[error_buf_size];
-        snprintf(buf, sizeof(buf), "Can't get addr: %s", gai_strerror(rv));
-        __redisSetError(c, REDIS_ERR_OTHER, buf);
-        goto error;
-      }
-
-      if (reuseaddr) {
-        n = 1;
-        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&n, sizeof(n)) < 0) {
-          freeaddrinfo(bservinfo);
-          goto error;
-        }
-      }
-
-      for (b = bservinfo; b != nullptr; b = b->ai_next) {
-        if (bind(s, b->ai_addr, b->ai_addrlen) != -1) {
-          bound = 1;
-          break;
-        }
-      }
-      freeaddrinfo(bservinfo);
-      if (!bound) {
-        char buf[error_buf_size];
-        snprintf(buf, sizeof(buf), "Can't bind socket: %s", strerror(errno));
-        __redisSetError(c, REDIS_ERR_OTHER, buf);
-        goto error;
-      }
-    }
+    if (c->tcp.source_addr && redisBindSourceAddr(c, s, hints) != REDIS_OK)
+      goto error;
 
     /* For repeat connection */
     hi_free(c->saddr);
@@ -602,8 +1265,7 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
       goto error;
 
     c->flags |= REDIS_CONNECTED;
-    rv = REDIS_OK;
-    goto end;
+    return REDIS_OK;
   }
   if (p == nullptr) {
     char buf[error_buf_size];
@@ -612,6 +1274,502 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
     goto error;
   }
 
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+error:
+  return REDIS_ERR;
+}
+
+/* Connect a blocking context by racing the addresses, others one by one */
+static int redisContextConnectResolved(redisContext *c, struct addrinfo *servinfo,
+                                       const struct addrinfo *hints, long timeout_msec) {
+  if (c->flags & REDIS_BLOCK)
+    return redisContextConnectRace(c, servinfo, hints, timeout_msec);
+  return redisContextConnectAddrs(c, servinfo, hints, timeout_msec);
+}
+
+/* The addresses a host name resolved to, reused until they fail to connect,
+ * however old they are. One allocation holds the entry, the addrinfo list, the addresses
+ * it points to and the host name, so copies are a memcpy() and a relink. */
+typedef struct redisAddrs {
+  struct redisAddrs *next; /* In the shared cache */
+  size_t size;             /* Of the allocation */
+  char *host;
+  int port;
+  int flags;             /* REDIS_PREFER_IPV4 and REDIS_PREFER_IPV6 of the lookup */
+  struct addrinfo hints; /* The family the lookup settled on */
+  size_t count;
+  struct addrinfo ai[];
+} redisAddrs;
+
+static constexpr int redisAddrsFamilyFlags = REDIS_PREFER_IPV4 | REDIS_PREFER_IPV6;
+
+static struct {
+  pthread_mutex_t lock;
+  redisAddrs *head; /* Most recently stored first */
+} redisAddrCache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static bool redisAddrsMatch(const redisAddrs *a, const char *host, int port, int flags) {
+  return a->port == port && a->flags == (flags & redisAddrsFamilyFlags) &&
+         strcmp(a->host, host) == 0;
+}
+
+/* Point the list, the addresses and the host name into the allocation */
+static void redisAddrsLink(redisAddrs *a) {
+  auto ss = (struct sockaddr_storage *)&a->ai[a->count];
+  for (size_t i = 0; i < a->count; i++) {
+    a->ai[i].ai_addr = (struct sockaddr *)&ss[i];
+    a->ai[i].ai_canonname = nullptr;
+    a->ai[i].ai_next = (i + 1 < a->count) ? &a->ai[i + 1] : nullptr;
+  }
+  a->host = (char *)&ss[a->count];
+}
+
+static redisAddrs *redisAddrsCreate(const char *host, int port, int flags,
+                                    const struct addrinfo *hints,
+                                    const struct addrinfo *servinfo) {
+  size_t count = 0;
+  for (auto p = servinfo; p != nullptr; p = p->ai_next) {
+    if (p->ai_addrlen > sizeof(struct sockaddr_storage))
+      return nullptr;
+    count++;
+  }
+  if (count == 0)
+    return nullptr;
+
+  auto hostlen = strlen(host) + 1;
+  auto size = sizeof(redisAddrs) +
+              count * (sizeof(struct addrinfo) + sizeof(struct sockaddr_storage)) + hostlen;
+  redisAddrs *a = hi_malloc(size);
+  if (a == nullptr)
+    return nullptr;
+
+  a->next = nullptr;
+  a->size = size;
+  a->port = port;
+  a->flags = flags & redisAddrsFamilyFlags;
+  a->hints = *hints;
+  a->count = count;
+
+  auto ss = (struct sockaddr_storage *)&a->ai[count];
+  size_t i = 0;
+  for (auto p = servinfo; p != nullptr; p = p->ai_next, i++) {
+    a->ai[i] = *p;
+    memcpy(&ss[i], p->ai_addr, p->ai_addrlen);
+  }
+  redisAddrsLink(a);
+  memcpy(a->host, host, hostlen);
+  return a;
+}
+
+static redisAddrs *redisAddrsCopy(const redisAddrs *a) {
+  redisAddrs *copy = hi_malloc(a->size);
+  if (copy == nullptr)
+    return nullptr;
+  memcpy(copy, a, a->size);
+  copy->next = nullptr;
+  redisAddrsLink(copy);
+  return copy;
+}
+
+/* Put a copy of a into the shared cache, in place of the entry of its host.
+ * The least recently stored host goes when the cache is full. */
+static void redisAddrCacheStore(const redisAddrs *a) {
+  auto copy = redisAddrsCopy(a);
+  if (copy == nullptr)
+    return;
+
+  pthread_mutex_lock(&redisAddrCache.lock);
+  copy->next = redisAddrCache.head;
+  redisAddrCache.head = copy;
+
+  int kept = 1;
+  redisAddrs **pp = &copy->next;
+  while (*pp != nullptr) {
+    auto e = *pp;
+    if (kept == REDIS_DNS_CACHE_HOSTS || redisAddrsMatch(e, a->host, a->port, a->flags)) {
+      *pp = e->next;
+      hi_free(e);
+    } else {
+      kept++;
+      pp = &e->next;
+    }
+  }
+  pthread_mutex_unlock(&redisAddrCache.lock);
+}
+
+/* A copy of the shared entry of host, nullptr when there is none */
+static redisAddrs *redisAddrCacheFetch(const char *host, int port, int flags) {
+  redisAddrs *found = nullptr;
+  pthread_mutex_lock(&redisAddrCache.lock);
+  for (auto e = redisAddrCache.head; e != nullptr; e = e->next) {
+    if (redisAddrsMatch(e, host, port, flags)) {
+      found = redisAddrsCopy(e);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&redisAddrCache.lock);
+  return found;
+}
+
+static void redisAddrCacheDrop(const char *host, int port, int flags) {
+  pthread_mutex_lock(&redisAddrCache.lock);
+  for (redisAddrs **pp = &redisAddrCache.head; *pp != nullptr; pp = &(*pp)->next) {
+    auto e = *pp;
+    if (redisAddrsMatch(e, host, port, flags)) {
+      *pp = e->next;
+      hi_free(e);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&redisAddrCache.lock);
+}
+
+/* Take the addresses cached for the host of c off the context, nullptr when
+ * the host has to be looked up */
+static redisAddrs *redisAddrsTake(redisContext *c) {
+  auto a = c->addrs;
+  c->addrs = nullptr;
+  if (a != nullptr && redisAddrsMatch(a, c->tcp.host, c->tcp.port, c->flags))
+    return a;
+  hi_free(a);
+
+  if (c->flags & REDIS_SHARED_DNS_CACHE)
+    return redisAddrCacheFetch(c->tcp.host, c->tcp.port, c->flags);
+  return nullptr;
+}
+
+/* Cache what the host of c was looked up to. Out of memory, it just isn't. */
+static void redisAddrsStore(redisContext *c, const struct addrinfo *hints,
+                            const struct addrinfo *servinfo) {
+  hi_free(c->addrs);
+  c->addrs = redisAddrsCreate(c->tcp.host, c->tcp.port, c->flags, hints, servinfo);
+  if (c->addrs != nullptr && (c->flags & REDIS_SHARED_DNS_CACHE))
+    redisAddrCacheStore(c->addrs);
+}
+
+/* The cached addresses failed to connect, the next connect looks them up */
+static void redisAddrsForget(redisContext *c) {
+  if (c->connection_type != REDIS_CONN_TCP)
+    return;
+  hi_free(c->addrs);
+  c->addrs = nullptr;
+  if (c->flags & REDIS_SHARED_DNS_CACHE)
+    redisAddrCacheDrop(c->tcp.host, c->tcp.port, c->flags);
+}
+
+/* Host name lookups of REDIS_OPT_ASYNC_DNS contexts run on a small pool of
+ * resolver threads. Until the lookup finished, the write end of a full pipe
+ * stands in for the socket: it never polls writable, so the event loop
+ * sleeps, until the resolver thread closes the read end, which reports the
+ * write end writable (with an error) and has the event loop call
+ * redisCheckConnectDone(). The connected socket then takes the descriptor
+ * number of the pipe, see redisResolveFinish(). */
+typedef struct redisResolve {
+  struct redisResolve *next;
+  char *host;
+  char port[6];
+  int flags;         /* Context flags picking the address family */
+  int rfd;           /* Read end of the pipe, closed by the resolver thread */
+  bool done;         /* The result below is set */
+  bool cancelled;    /* The context went away, the resolver thread frees this */
+  int rv;            /* getaddrinfo() result */
+  struct addrinfo hints;
+  struct addrinfo *servinfo;
+} redisResolve;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  redisResolve *head, *tail; /* Lookups waiting for a thread */
+  int threads;
+  int idle;
+} redisResolver = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+static void redisResolveFree(redisResolve *r) {
+  if (r->servinfo != nullptr)
+    freeaddrinfo(r->servinfo);
+  hi_free(r->host);
+  hi_free(r);
+}
+
+static void *redisResolverThread([[maybe_unused]] void *arg) {
+  char buf[4'096];
+
+  pthread_mutex_lock(&redisResolver.lock);
+  for (;;) {
+    while (redisResolver.head == nullptr) {
+      redisResolver.idle++;
+      pthread_cond_wait(&redisResolver.wake, &redisResolver.lock);
+      redisResolver.idle--;
+    }
+    auto r = redisResolver.head;
+    redisResolver.head = r->next;
+    if (redisResolver.head == nullptr)
+      redisResolver.tail = nullptr;
+    auto cancelled = r->cancelled;
+    pthread_mutex_unlock(&redisResolver.lock);
+
+    struct addrinfo hints = {0};
+    struct addrinfo *servinfo = nullptr;
+    auto rv = cancelled ? EAI_AGAIN : redisLookupTcp(r->host, r->port, r->flags, &hints, &servinfo);
+    if (rv != 0)
+      servinfo = nullptr;
+
+    pthread_mutex_lock(&redisResolver.lock);
+    auto rfd = r->rfd;
+    r->rv = rv;
+    r->hints = hints;
+    r->servinfo = servinfo;
+    if (r->cancelled)
+      redisResolveFree(r);
+    else
+      r->done = true;
+
+    /* Empty the pipe and close it, so the event loop finds the stand-in
+     * writable */
+    while (read(rfd, buf, sizeof(buf)) > 0) {
+    }
+    close(rfd);
+  }
+  return nullptr;
+}
+
+/* Hand a lookup to the resolver threads, starting one when none is idle */
+static int redisResolverSubmit(redisResolve *r) {
+  pthread_mutex_lock(&redisResolver.lock);
+  if (redisResolver.idle == 0 && redisResolver.threads < REDIS_RESOLVER_THREADS) {
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, redisResolverThread, nullptr) == 0) {
+      pthread_detach(thread);
+      redisResolver.threads++;
+    } else if (redisResolver.threads == 0) {
+      pthread_mutex_unlock(&redisResolver.lock);
+      return REDIS_ERR;
+    }
+  }
+  if (redisResolver.tail != nullptr)
+    redisResolver.tail->next = r;
+  else
+    redisResolver.head = r;
+  redisResolver.tail = r;
+  pthread_cond_signal(&redisResolver.wake);
+  pthread_mutex_unlock(&redisResolver.lock);
+  return REDIS_OK;
+}
+
+/* Open the pipe standing in for the socket, its write end full */
+static int redisResolvePipe(int p[2]) {
+  static const char fill[4'096];
+
+#ifdef __linux__
+  if (pipe2(p, O_CLOEXEC | O_NONBLOCK) == -1)
+    return -1;
+  /* One page is all there is to fill */
+  fcntl(p[1], F_SETPIPE_SZ, (int)sizeof(fill));
+#else
+  if (pipe(p) == -1)
+    return -1;
+  for (int i = 0; i < 2; i++) {
+    if (fcntl(p[i], F_SETFD, FD_CLOEXEC) == -1 || fcntl(p[i], F_SETFL, O_NONBLOCK) == -1) {
+      close(p[0]);
+      close(p[1]);
+      return -1;
+    }
+  }
+#endif
+
+  while (write(p[1], fill, sizeof(fill)) > 0) {
+  }
+  while (write(p[1], fill, 1) > 0) {
+  }
+  return 0;
+}
+
+/* Start looking up the host of c in the background */
+static int redisResolveStart(redisContext *c, const char *port) {
+  int p[2];
+
+  redisResolve *r = hi_calloc(1, sizeof(*r));
+  if (r == nullptr)
+    goto oom;
+  r->host = hi_strdup(c->tcp.host);
+  if (r->host == nullptr) {
+    hi_free(r);
+    goto oom;
+  }
+  memcpy(r->port, port, sizeof(r->port));
+  r->flags = c->flags;
+
+  if (redisResolvePipe(p) == -1) {
+    __redisSetErrorFromErrno(c, REDIS_ERR_IO, "pipe");
+    redisResolveFree(r);
+    return REDIS_ERR;
+  }
+  r->rfd = p[0];
+
+  if (redisResolverSubmit(r) != REDIS_OK) {
+    __redisSetError(c, REDIS_ERR_OTHER, "Can't start a resolver thread");
+    close(p[0]);
+    close(p[1]);
+    redisResolveFree(r);
+    return REDIS_ERR;
+  }
+  c->fd = p[1];
+  c->resolve = r;
+  return REDIS_OK;
+
+oom:
+  __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+  return REDIS_ERR;
+}
+
+/* Drop the lookup of a context that is closed before it finished */
+static void redisResolveCancel(redisContext *c) {
+  auto r = c->resolve;
+  c->resolve = nullptr;
+
+  pthread_mutex_lock(&redisResolver.lock);
+  auto done = r->done;
+  r->cancelled = true;
+  pthread_mutex_unlock(&redisResolver.lock);
+  if (done)
+    redisResolveFree(r);
+}
+
+/* Connect once the lookup finished. The socket is moved to the descriptor
+ * number of the pipe, so event libraries watching that number keep working,
+ * those that registered the pipe itself are told with ev.updateFd. */
+static int redisResolveFinish(redisContext *c) {
+  auto r = c->resolve;
+  long timeout_msec = -1;
+
+  pthread_mutex_lock(&redisResolver.lock);
+  auto done = r->done;
+  pthread_mutex_unlock(&redisResolver.lock);
+  if (!done)
+    return REDIS_OK;
+  c->resolve = nullptr;
+
+  if (r->rv != 0) {
+    __redisSetError(c, REDIS_ERR_OTHER, gai_strerror(r->rv));
+    redisResolveFree(r);
+    return REDIS_ERR;
+  }
+  redisAddrsStore(c, &r->hints, r->servinfo);
+
+  auto standin = c->fd;
+  c->fd = REDIS_INVALID_FD;
+  auto rv = redisContextTimeoutMsec(c, &timeout_msec);
+  if (rv == REDIS_OK)
+    rv = redisContextConnectAddrs(c, r->servinfo, &r->hints, timeout_msec);
+  redisResolveFree(r);
+
+  /* Connected or not, the context waits for the connect to finish */
+  c->flags &= ~REDIS_CONNECTED;
+  if (rv == REDIS_OK && dup2(c->fd, standin) == -1) {
+    __redisSetErrorFromErrno(c, REDIS_ERR_IO, "dup2");
+    rv = REDIS_ERR;
+  }
+  if (c->fd != REDIS_INVALID_FD)
+    close(c->fd);
+  c->fd = standin;
+
+  /* dup2() doesn't carry over close-on-exec */
+  if (rv == REDIS_OK && (c->flags & REDIS_OPT_SET_SOCK_CLOEXEC))
+    fcntl(c->fd, F_SETFD, FD_CLOEXEC);
+  return rv;
+}
+
+static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
+                                   const struct timeval *timeout, const char *source_addr) {
+  int rv;
+  constexpr size_t port_buf_size = 6; /* strlen("65535"); */
+  char port_buf[port_buf_size];
+  struct addrinfo hints = {0};
+  struct addrinfo *servinfo;
+  long timeout_msec = -1;
+
+  servinfo = nullptr;
+  c->connection_type = REDIS_CONN_TCP;
+  c->tcp.port = port;
+
+  /* We need to take possession of the passed parameters
+   * to make them reusable for a reconnect.
+   * We also carefully check we don't free data we already own,
+   * as in the case of the reconnect method.
+   *
+   * This is a bit ugly, but atleast it works and doesn't leak memory.
+   **/
+  if (c->tcp.host != addr) {
+    hi_free(c->tcp.host);
+
+    c->tcp.host = hi_strdup(addr);
+    if (c->tcp.host == nullptr)
+      goto oom;
+  }
+
+  if (timeout) {
+    if (redisContextUpdateConnectTimeout(c, timeout) == REDIS_ERR)
+      goto oom;
+  } else {
+    hi_free(c->connect_timeout);
+    c->connect_timeout = nullptr;
+  }
+
+  if (redisContextTimeoutMsec(c, &timeout_msec) != REDIS_OK) {
+    goto error;
+  }
+
+  if (source_addr == nullptr) {
+    hi_free(c->tcp.source_addr);
+    c->tcp.source_addr = nullptr;
+  } else if (c->tcp.source_addr != source_addr) {
+    hi_free(c->tcp.source_addr);
+    c->tcp.source_addr = hi_strdup(source_addr);
+    if (c->tcp.source_addr == nullptr)
+      goto oom;
+  }
+
+  snprintf(port_buf, sizeof(port_buf), "%d", port);
+
+  /* Reconnects, and connects to a host in the shared cache, go straight to
+   * connect(). Cached addresses that fail are forgotten and the host is looked
+   * up again, the new addresses get a connect timeout of their own. */
+  auto cached = redisAddrsTake(c);
+  if (cached != nullptr) {
+    rv = redisContextConnectResolved(c, cached->ai, &cached->hints, timeout_msec);
+    if (rv == REDIS_OK) {
+      c->addrs = cached;
+      return REDIS_OK;
+    }
+    hi_free(cached);
+    redisAddrsForget(c);
+    redisNetClose(c);
+    c->err = 0;
+    c->errstr[0] = '\0';
+  }
+
+  /* Numeric addresses are taken right away, names are looked up by a
+   * resolver thread for a nonblocking context that asks for it */
+  if ((c->flags & (REDIS_BLOCK | REDIS_ASYNC_DNS)) == REDIS_ASYNC_DNS) {
+    hints.ai_flags = AI_NUMERICHOST;
+    rv = redisLookupTcp(c->tcp.host, port_buf, c->flags, &hints, &servinfo);
+    if (rv == EAI_NONAME)
+      return redisResolveStart(c, port_buf);
+    hints.ai_flags = 0;
+  } else {
+    rv = redisLookupTcp(c->tcp.host, port_buf, c->flags, &hints, &servinfo);
+  }
+  if (rv != 0) {
+    __redisSetError(c, REDIS_ERR_OTHER, gai_strerror(rv));
+    return REDIS_ERR;
+  }
+
+  redisAddrsStore(c, &hints, servinfo);
+  rv = redisContextConnectResolved(c, servinfo, &hints, timeout_msec);
+  goto end;
+
 oom:
   __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
 error:
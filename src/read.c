@@ -415,6 +415,59 @@ static int processLineItem(redisReader *r) {
   return REDIS_ERR;
 }
 
+/* Copy whatever is buffered into the bulk string being received in place and
+ * finish it once the payload and its trailing \r\n are in. */
+static int processBulkInPlace(redisReader *r) {
+  size_t avail = r->len - r->pos;
+  size_t missing = r->bulklen - r->bulkpos;
+  size_t n = avail < missing ? avail : missing;
+
+  memcpy(r->bulk + r->bulkpos, r->buf + r->pos, n);
+  r->bulkpos += n;
+  r->pos += n;
+
+  if (r->bulkpos < r->bulklen || r->len - r->pos < 2)
+    return REDIS_ERR;
+
+  r->pos += 2;
+  r->bulk = nullptr;
+  r->bulklen = r->bulkpos = 0;
+  moveToNextTask(r);
+  return REDIS_OK;
+}
+
+/* Start receiving a bulk string of len bytes straight into storage from the
+ * object functions, so it is never accumulated in the read buffer. */
+static int startBulkInPlace(redisReader *r, redisReadTask *cur, size_t len) {
+  char *buf = nullptr;
+  int flags = 0;
+
+  if (r->mmapthreshold > 0 && len >= r->mmapthreshold)
+    flags = r->mmapflags | REDIS_READER_MMAP;
+
+  /* Set directly instead of with redisReaderSetStrAlign() */
+  if ((r->stralign & (r->stralign - 1)) != 0) {
+    __redisReaderSetError(r, REDIS_ERR_OTHER, "stralign is not a power of two");
+    return REDIS_ERR;
+  }
+
+  void *obj = r->fn->createStringBuffer(cur, len, r->stralign, flags, &buf);
+  if (obj == nullptr) {
+    __redisReaderSetErrorOOM(r);
+    return REDIS_ERR;
+  }
+
+  /* Set reply now when this is the root object, so it is freed with the
+   * reader if the rest never arrives. */
+  if (r->ridx == 0)
+    r->reply = obj;
+
+  r->bulk = buf;
+  r->bulklen = len;
+  r->bulkpos = 0;
+  return processBulkInPlace(r);
+}
+
 static int processBulkItem(redisReader *r) {
   redisReadTask *cur = r->task[r->ridx];
   void *obj = nullptr;
@@ -423,6 +476,9 @@ static int processBulkItem(redisReader *r) {
   size_t bytelen;
   bool success = false;
 
+  if (r->bulk != nullptr)
+    return processBulkInPlace(r);
+
   p = r->buf + r->pos;
   s = seekNewline(p, r->len - r->pos);
   if (s != nullptr) {
@@ -456,6 +512,12 @@ static int processBulkItem(redisReader *r) {
 
       size_t total_len = bytelen + payload_len + 2; /* include payload + trailing \r\n */
 
+      if (cur->type == REDIS_REPLY_STRING && r->fn && r->fn->createStringBuffer &&
+          (r->stralign > 0 || (r->mmapthreshold > 0 && payload_len >= r->mmapthreshold))) {
+        r->pos += bytelen;
+        return startBulkInPlace(r, cur, payload_len);
+      }
+
       /* Only continue when the buffer contains the entire bulk item. */
       if (total_len <= (r->len - r->pos)) {
         if ((cur->type == REDIS_REPLY_VERB && payload_len < 4) ||
@@ -781,6 +843,26 @@ oom:
   return REDIS_ERR;
 }
 
+int redisReaderSetStrAlign(redisReader *r, size_t align) {
+  if ((align & (align - 1)) != 0)
+    return REDIS_ERR;
+  r->stralign = align;
+  return REDIS_OK;
+}
+
+char *redisReaderBulkBuffer(redisReader *r, size_t *len) {
+  if (r->err || r->bulk == nullptr || r->pos < r->len || r->bulkpos == r->bulklen)
+    return nullptr;
+
+  *len = r->bulklen - r->bulkpos;
+  return r->bulk + r->bulkpos;
+}
+
+void redisReaderBulkWritten(redisReader *r, size_t len) {
+  assert(r->bulk != nullptr && len <= r->bulklen - r->bulkpos);
+  r->bulkpos += len;
+}
+
 int redisReaderGetReply(redisReader *r, void **reply) {
   /* Default target pointer to nullptr. */
   if (reply != nullptr)
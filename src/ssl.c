@@ -524,8 +524,15 @@ static ssize_t redisSSLRead(redisContext *c, char *buf, size_t bufcap) {
 static ssize_t redisSSLWrite(redisContext *c) {
   redisSSL *rssl = c->privctx;
 
-  size_t len = rssl->lastLen ? rssl->lastLen : sdslen(c->obuf);
-  auto rv = SSL_write(rssl->ssl, c->obuf, len);
+  /* TLS records are built from one buffer at a time. A retried SSL_write()
+   * must be given the same length, which is why lastLen is kept. */
+  size_t len;
+  const char *buf = redisOutputPeek(c, &len);
+  if (buf == nullptr)
+    return -1;
+  if (rssl->lastLen)
+    len = rssl->lastLen;
+  auto rv = SSL_write(rssl->ssl, buf, len);
 
   if (rv > 0) {
     rssl->lastLen = 0;
@@ -594,6 +601,9 @@ static void redisSSLAsyncWrite(redisAsyncContext *ac) {
       /* No extra reads needed, just need to write more */
       _EL_ADD_WRITE(ac);
     }
+  } else if (ac->lazyfree.depth > 0) {
+    /* Keep ticking while replies are being freed */
+    _EL_ADD_WRITE(ac);
   } else {
     /* Already done! */
     _EL_DEL_WRITE(ac);
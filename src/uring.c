@@ -0,0 +1,1119 @@
+/* io_uring transport, see hiredis_uring.h.
+ *
+ * The rings are set up and entered with raw system calls, no liburing is
+ * needed. Async contexts share a redisUring: each connection keeps one
+ * multishot recv armed on the ring's provided buffers and sends its output
+ * with sendmsg(): the bytes of obuf are staged into a buffer of its own, so
+ * obuf can grow or be compacted while a send is in flight, and refs are sent
+ * from their own memory. Contexts only mark themselves dirty from the event
+ * hooks, and redisUringTick() queues the I/O of all dirty contexts before
+ * entering the kernel once.
+ *
+ * Blocking contexts own a small ring. Their writes are a sendmsg() linked to
+ * a recv into a private buffer: io_uring_enter() waits for the send only and
+ * the recv completes meanwhile, to be collected by the next read. */
+
+#include <errno.h>
+#include <string.h>
+
+#include "hiredis/alloc.h"
+#include "hiredis/async.h"
+#include "hiredis/async_private.h"
+#include "hiredis/hiredis.h"
+#include "hiredis/hiredis_uring.h"
+#include "hiredis/net.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+/* Headers with multishot recv (6.0) also have provided buffer rings */
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_FEAT_EXT_ARG)
+
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+void __redisSetError(redisContext *c, int type, const char *str);
+
+/* Operations are told apart by the low bits of their user_data, the rest is
+ * the connection. Cancel requests carry no connection. */
+static constexpr uint64_t REDIS_URING_RECV = 1;
+static constexpr uint64_t REDIS_URING_SEND = 2;
+static constexpr uint64_t REDIS_URING_POLL = 3;
+static constexpr uint64_t REDIS_URING_OPMASK = 3;
+
+/* Buffer group of the provided receive buffers */
+static constexpr uint16_t REDIS_URING_BGID = 0;
+
+/* Submission queue size of a blocking context's ring */
+static constexpr unsigned REDIS_URING_SYNC_ENTRIES = 8;
+
+/* A mapped io_uring instance. */
+typedef struct redisUringQueue {
+  int fd;
+  unsigned *sqhead;
+  unsigned *sqtail;
+  unsigned sqmask;
+  unsigned sqentries;
+  unsigned sqlocal; /* Tail including the SQEs filled since the last enter */
+  struct io_uring_sqe *sqes;
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned cqmask;
+  struct io_uring_cqe *cqes;
+  void *rings;
+  size_t ringsz;
+  size_t sqesz;
+} redisUringQueue;
+
+typedef struct redisUringConn redisUringConn;
+
+struct redisUring {
+  redisUringQueue q;
+  struct io_uring_buf_ring *br;
+  size_t brsz;
+  char *bufs;
+  unsigned nbufs;
+  uint16_t brtail;
+  bool oneshot; /* Multishot recv was refused, Linux 5.19 */
+  unsigned inflight;
+  redisUringConn *conns; /* Attached contexts */
+  redisUringConn *dead;  /* Freed contexts with operations still in flight */
+  redisUringConn *dirty; /* Contexts with I/O to queue on the next tick */
+};
+
+struct redisUringConn {
+  redisUring *ring;
+  redisAsyncContext *ac; /* nullptr once the context is gone */
+  redisUringConn *prev;
+  redisUringConn *next;
+  redisUringConn *dirtynext;
+  int fd;
+  bool reading;
+  bool writing;
+  bool dirty;
+
+  /* Operations in flight */
+  bool recving;
+  bool sending;
+  bool polling;
+  int inflight;
+
+  /* Received bytes not handed to the reader yet */
+  const char *rbuf;
+  size_t rlen;
+  bool rheld; /* rbuf is in hbuf, not in a provided buffer */
+  char *hbuf; /* Bytes left unread while a GET payload waits for its fd */
+  size_t hcap;
+  bool reof; /* The receive ended, rerr is 0 for EOF */
+  int rerr;
+
+  /* Result of a send, until redisBufferWrite() picks it up */
+  bool sent;
+  int sendres;
+
+  /* Message of the send in flight, with the staged bytes of obuf */
+  struct msghdr smsg;
+  struct iovec siov[REDIS_IOV_MAX];
+  bool sref; /* It points into refs too */
+  char *sbuf;
+  size_t scap;
+
+  double deadline;
+};
+
+/* Private ring of a blocking context. */
+typedef struct redisUringSync {
+  redisUringQueue q;
+  bool recving;  /* A recv into buf was submitted */
+  bool received; /* It completed with res */
+  int res;
+  size_t off; /* Bytes of buf already read */
+  char buf[REDIS_URING_BUFSIZE];
+} redisUringSync;
+
+static void redisUringQueueClose(redisUringQueue *q) {
+  int err = errno;
+
+  if (q->sqes != nullptr)
+    munmap(q->sqes, q->sqesz);
+  if (q->rings != nullptr)
+    munmap(q->rings, q->ringsz);
+  if (q->fd != -1)
+    close(q->fd);
+  errno = err;
+}
+
+static int redisUringQueueInit(redisUringQueue *q, unsigned entries) {
+  struct io_uring_params p;
+
+  memset(q, 0, sizeof(*q));
+  q->fd = -1;
+
+  memset(&p, 0, sizeof(p));
+  q->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (q->fd == -1)
+    return REDIS_ERR;
+
+  /* Timed waits need IORING_ENTER_EXT_ARG (5.11), which also implies that
+   * both rings share one mapping */
+  if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    errno = ENOSYS;
+    goto error;
+  }
+
+  size_t sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  q->ringsz = sqsz > cqsz ? sqsz : cqsz;
+  q->rings = mmap(nullptr, q->ringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd,
+                  IORING_OFF_SQ_RING);
+  if (q->rings == MAP_FAILED) {
+    q->rings = nullptr;
+    goto error;
+  }
+  q->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+  q->sqes = mmap(nullptr, q->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd,
+                 IORING_OFF_SQES);
+  if (q->sqes == MAP_FAILED) {
+    q->sqes = nullptr;
+    goto error;
+  }
+
+  char *base = q->rings;
+  q->sqhead = (unsigned *)(base + p.sq_off.head);
+  q->sqtail = (unsigned *)(base + p.sq_off.tail);
+  q->sqmask = *(unsigned *)(base + p.sq_off.ring_mask);
+  q->sqentries = p.sq_entries;
+  q->cqhead = (unsigned *)(base + p.cq_off.head);
+  q->cqtail = (unsigned *)(base + p.cq_off.tail);
+  q->cqmask = *(unsigned *)(base + p.cq_off.ring_mask);
+  q->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+
+  /* SQEs are used in ring order, the index array never changes */
+  auto array = (unsigned *)(base + p.sq_off.array);
+  for (unsigned i = 0; i < p.sq_entries; i++)
+    array[i] = i;
+  q->sqlocal = *q->sqtail;
+  return REDIS_OK;
+
+error:
+  redisUringQueueClose(q);
+  return REDIS_ERR;
+}
+
+static unsigned redisUringQueued(redisUringQueue *q) {
+  return q->sqlocal - atomic_load_explicit((_Atomic unsigned *)q->sqhead, memory_order_acquire);
+}
+
+/* Submit the filled SQEs and wait for wait completions, no longer than
+ * timeout seconds unless it is negative. Returns the io_uring_enter() result,
+ * or -errno. */
+static int redisUringEnter(redisUringQueue *q, unsigned wait, double timeout) {
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg = {.sigmask = 0, .sigmask_sz = _NSIG / 8};
+  unsigned flags = 0;
+  const void *argp = nullptr;
+  size_t argsz = _NSIG / 8;
+
+  atomic_store_explicit((_Atomic unsigned *)q->sqtail, q->sqlocal, memory_order_release);
+  auto submit = redisUringQueued(q);
+  if (submit == 0 && wait == 0)
+    return 0;
+
+  if (wait > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout >= 0.0) {
+      ts.tv_sec = (long long)timeout;
+      ts.tv_nsec = (long long)((timeout - (double)ts.tv_sec) * 1e9);
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argsz = sizeof(arg);
+    }
+  }
+
+  auto ret = (int)syscall(__NR_io_uring_enter, q->fd, submit, wait, flags, argp, argsz);
+  return ret < 0 ? -errno : ret;
+}
+
+/* A zeroed SQE, submitting the queued ones first when the ring is full. */
+static struct io_uring_sqe *redisUringSqe(redisUringQueue *q, uint8_t op, int fd, uint64_t data) {
+  if (redisUringQueued(q) >= q->sqentries) {
+    redisUringEnter(q, 0, -1.0);
+    if (redisUringQueued(q) >= q->sqentries)
+      return nullptr;
+  }
+
+  auto sqe = &q->sqes[q->sqlocal & q->sqmask];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->user_data = data;
+  q->sqlocal++;
+  return sqe;
+}
+
+/* Pop the next completion into *cqe. */
+static bool redisUringCqe(redisUringQueue *q, struct io_uring_cqe *cqe) {
+  auto head = *q->cqhead;
+  if (head == atomic_load_explicit((_Atomic unsigned *)q->cqtail, memory_order_acquire))
+    return false;
+  *cqe = q->cqes[head & q->cqmask];
+  atomic_store_explicit((_Atomic unsigned *)q->cqhead, head + 1, memory_order_release);
+  return true;
+}
+
+static bool redisUringHasCqe(redisUringQueue *q) {
+  return *q->cqhead != atomic_load_explicit((_Atomic unsigned *)q->cqtail, memory_order_acquire);
+}
+
+static void redisUringCancel(redisUringQueue *q, uint64_t data) {
+  auto sqe = redisUringSqe(q, IORING_OP_ASYNC_CANCEL, -1, 0);
+  if (sqe != nullptr)
+    sqe->addr = data;
+}
+
+static double redisUringNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Hand a provided buffer back to the kernel. */
+static void redisUringRecycle(redisUring *ring, unsigned bid) {
+  auto buf = &ring->br->bufs[ring->brtail & (ring->nbufs - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * REDIS_URING_BUFSIZE);
+  buf->len = REDIS_URING_BUFSIZE;
+  buf->bid = (uint16_t)bid;
+  ring->brtail++;
+  atomic_store_explicit((_Atomic uint16_t *)&ring->br->tail, ring->brtail, memory_order_release);
+}
+
+static void redisUringMarkDirty(redisUringConn *conn) {
+  if (conn->dirty || conn->ac == nullptr)
+    return;
+  conn->dirty = true;
+  conn->dirtynext = conn->ring->dirty;
+  conn->ring->dirty = conn;
+}
+
+static uint64_t redisUringData(redisUringConn *conn, uint64_t op) {
+  return (uint64_t)(uintptr_t)conn | op;
+}
+
+static void redisUringUnlink(redisUringConn **list, redisUringConn *conn) {
+  if (conn->prev != nullptr)
+    conn->prev->next = conn->next;
+  else
+    *list = conn->next;
+  if (conn->next != nullptr)
+    conn->next->prev = conn->prev;
+  conn->prev = conn->next = nullptr;
+}
+
+static void redisUringLink(redisUringConn **list, redisUringConn *conn) {
+  conn->prev = nullptr;
+  conn->next = *list;
+  if (*list != nullptr)
+    (*list)->prev = conn;
+  *list = conn;
+}
+
+static bool redisUringStart(redisUringConn *conn, struct io_uring_sqe *sqe, bool *flag) {
+  if (sqe == nullptr) {
+    /* The ring is full, try again on the next tick */
+    redisUringMarkDirty(conn);
+    return false;
+  }
+  *flag = true;
+  conn->inflight++;
+  conn->ring->inflight++;
+  return true;
+}
+
+/* Build the message sending the head of the output queue. Bytes of obuf are
+ * copied into the connection's send buffer, refs are sent in place. */
+static ssize_t redisUringStage(redisUringConn *conn, redisContext *c) {
+  auto iov = conn->siov;
+  size_t len = 0;
+  size_t copy = 0;
+
+  auto iovcnt = redisOutputIov(c, iov, REDIS_IOV_MAX);
+  if (iovcnt == 0) {
+    /* File refs are read a chunk at a time */
+    iov[0].iov_base = (void *)redisOutputPeek(c, &iov[0].iov_len);
+    if (iov[0].iov_base == nullptr)
+      return -1;
+    iovcnt = 1;
+  }
+
+  auto obuf = (uintptr_t)c->obuf;
+  auto obufend = obuf + sdslen(c->obuf);
+  int n = 0;
+  for (; n < iovcnt && len < REDIS_URING_SEND_MAX; n++) {
+    if (iov[n].iov_len > REDIS_URING_SEND_MAX - len)
+      iov[n].iov_len = REDIS_URING_SEND_MAX - len;
+    len += iov[n].iov_len;
+    auto base = (uintptr_t)iov[n].iov_base;
+    if (base >= obuf && base < obufend)
+      copy += iov[n].iov_len;
+  }
+
+  if (copy > conn->scap) {
+    auto sbuf = (char *)hi_realloc(conn->sbuf, copy);
+    if (sbuf == nullptr) {
+      __redisSetError(c, REDIS_ERR_OOM, "Out of memory");
+      return -1;
+    }
+    conn->sbuf = sbuf;
+    conn->scap = copy;
+  }
+
+  size_t off = 0;
+  conn->sref = false;
+  for (int i = 0; i < n; i++) {
+    auto base = (uintptr_t)iov[i].iov_base;
+    if (base >= obuf && base < obufend) {
+      memcpy(conn->sbuf + off, iov[i].iov_base, iov[i].iov_len);
+      iov[i].iov_base = conn->sbuf + off;
+      off += iov[i].iov_len;
+    } else {
+      conn->sref = true;
+    }
+  }
+  conn->smsg = (struct msghdr){.msg_iov = iov, .msg_iovlen = (size_t)n};
+  return (ssize_t)len;
+}
+
+/* Queue the operations a dirty connection asked for. */
+static void redisUringPrepare(redisUringConn *conn) {
+  auto ring = conn->ring;
+
+  conn->dirty = false;
+  if (conn->ac == nullptr)
+    return;
+  auto ac = conn->ac;
+  auto c = &ac->c;
+
+  /* Wait for the connection to be established by polling for writability,
+   * as the other adapters do */
+  if (!(c->flags & REDIS_CONNECTED)) {
+    if (conn->writing && !conn->polling) {
+      auto sqe = redisUringSqe(&ring->q, IORING_OP_POLL_ADD, conn->fd,
+                               redisUringData(conn, REDIS_URING_POLL));
+      if (redisUringStart(conn, sqe, &conn->polling)) {
+        uint32_t mask = POLLOUT;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        mask = mask << 16 | mask >> 16;
+#endif
+        sqe->poll32_events = mask;
+      }
+    }
+    return;
+  }
+
+  if (conn->reading && !conn->recving && !conn->reof && conn->rlen == 0) {
+    auto sqe = redisUringSqe(&ring->q, IORING_OP_RECV, conn->fd,
+                             redisUringData(conn, REDIS_URING_RECV));
+    if (redisUringStart(conn, sqe, &conn->recving)) {
+      if (!ring->oneshot)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = REDIS_URING_BGID;
+    }
+  }
+
+  if (conn->writing && !conn->sending) {
+    /* Nothing to send while replies are still being freed lazily: the
+     * socket counts as writable */
+    if (redisOutputPending(c) == 0) {
+      redisAsyncHandleWrite(ac);
+      return;
+    }
+
+    auto len = redisUringStage(conn, c);
+    if (len < 0) {
+      /* Disconnects with the error that was set */
+      redisAsyncHandleWrite(ac);
+      return;
+    }
+    auto sqe = redisUringSqe(&ring->q, IORING_OP_SENDMSG, conn->fd,
+                             redisUringData(conn, REDIS_URING_SEND));
+    if (redisUringStart(conn, sqe, &conn->sending)) {
+      sqe->addr = (uint64_t)(uintptr_t)&conn->smsg;
+      sqe->len = 1;
+    }
+  }
+}
+
+/* Move the unread bytes into the connection's hold buffer, followed by the
+ * len bytes at buf, so the provided buffer they came in can go back. */
+static bool redisUringHold(redisUringConn *conn, const char *buf, size_t len) {
+  auto unread = conn->rlen;
+
+  if (conn->rheld)
+    memmove(conn->hbuf, conn->rbuf, unread);
+  if (unread + len > conn->hcap) {
+    auto hbuf = (char *)hi_realloc(conn->hbuf, unread + len);
+    if (hbuf == nullptr)
+      return false;
+    conn->hbuf = hbuf;
+    conn->hcap = unread + len;
+  }
+  if (!conn->rheld)
+    memcpy(conn->hbuf, conn->rbuf, unread);
+  if (len > 0)
+    memcpy(conn->hbuf + unread, buf, len);
+  conn->rbuf = conn->hbuf;
+  conn->rlen = unread + len;
+  conn->rheld = true;
+  return true;
+}
+
+/* Dispatch a completion to the connection it belongs to. Completions of
+ * freed contexts only release their resources. */
+static void redisUringComplete(redisUring *ring, const struct io_uring_cqe *cqe) {
+  auto conn = (redisUringConn *)(uintptr_t)(cqe->user_data & ~REDIS_URING_OPMASK);
+  if (conn == nullptr)
+    return;
+
+  switch (cqe->user_data & REDIS_URING_OPMASK) {
+  case REDIS_URING_RECV:
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      conn->recving = false;
+      conn->inflight--;
+      ring->inflight--;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      if (conn->ac != nullptr && cqe->res > 0) {
+        auto buf = ring->bufs + (size_t)bid * REDIS_URING_BUFSIZE;
+        bool held = true;
+        if (conn->rlen == 0) {
+          conn->rbuf = buf;
+          conn->rlen = (size_t)cqe->res;
+          conn->rheld = false;
+        } else {
+          /* Behind bytes that wait for a full descriptor */
+          held = redisUringHold(conn, buf, (size_t)cqe->res);
+        }
+        if (held)
+          redisAsyncHandleRead(conn->ac);
+
+        /* What a full descriptor left unread is kept for the write event that
+         * resumes it, and nothing more is received until then */
+        if (conn->ac != nullptr && conn->rlen > 0 && !conn->rheld) {
+          held = redisUringHold(conn, nullptr, 0);
+          if (held && conn->recving && !ring->oneshot)
+            redisUringCancel(&ring->q, redisUringData(conn, REDIS_URING_RECV));
+        }
+        if (conn->ac != nullptr && !held) {
+          __redisSetError(&conn->ac->c, REDIS_ERR_OOM, "Out of memory");
+          __redisAsyncDisconnect(conn->ac);
+        }
+      }
+      redisUringRecycle(ring, bid);
+    } else if (cqe->res == -EINVAL && !ring->oneshot) {
+      ring->oneshot = true;
+    } else if (cqe->res <= 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED &&
+               cqe->res != -EINTR && cqe->res != -EAGAIN) {
+      if (conn->ac != nullptr) {
+        conn->reof = true;
+        conn->rerr = -cqe->res;
+        redisAsyncHandleRead(conn->ac);
+      }
+    }
+    /* Multishot receives end when the buffers ran out */
+    if (conn->ac != nullptr && !conn->recving && conn->reading && !conn->reof)
+      redisUringMarkDirty(conn);
+    break;
+  case REDIS_URING_SEND:
+    conn->sending = false;
+    conn->inflight--;
+    ring->inflight--;
+    if (conn->ac != nullptr) {
+      conn->sent = true;
+      conn->sendres = cqe->res;
+      redisAsyncHandleWrite(conn->ac);
+      conn->sent = false;
+    }
+    break;
+  case REDIS_URING_POLL:
+    conn->polling = false;
+    conn->inflight--;
+    ring->inflight--;
+    if (conn->ac != nullptr) {
+      redisAsyncHandleWrite(conn->ac);
+      if (conn->ac != nullptr && conn->writing)
+        redisUringMarkDirty(conn);
+    }
+    break;
+  }
+}
+
+static ssize_t redisUringRead(redisContext *c, char *buf, size_t bufcap) {
+  redisUringConn *conn = c->privctx;
+
+  if (conn->rlen > 0) {
+    auto n = conn->rlen < bufcap ? conn->rlen : bufcap;
+    memcpy(buf, conn->rbuf, n);
+    conn->rbuf += n;
+    conn->rlen -= n;
+    return (ssize_t)n;
+  }
+  if (conn->reof) {
+    if (conn->rerr == 0)
+      __redisSetError(c, REDIS_ERR_EOF, "Server closed the connection");
+    else
+      __redisSetError(c, REDIS_ERR_IO, strerror(conn->rerr));
+    return -1;
+  }
+  return 0;
+}
+
+static ssize_t redisUringWrite(redisContext *c) {
+  redisUringConn *conn = c->privctx;
+
+  /* Nothing is written until the send of the staged output completed */
+  if (!conn->sent)
+    return 0;
+  conn->sent = false;
+  if (conn->sendres >= 0)
+    return conn->sendres;
+  if (conn->sendres == -EAGAIN || conn->sendres == -EINTR)
+    return 0;
+  __redisSetError(c, REDIS_ERR_IO, strerror(-conn->sendres));
+  return -1;
+}
+
+static void redisUringAsyncRead(redisAsyncContext *ac) {
+  redisUringConn *conn = ac->c.privctx;
+  size_t bulkavail;
+
+  /* Everything received may be waiting in the pipe of a GET to a descriptor,
+   * which only redisBufferRead() writes out */
+  if (ac->c.tofd.inpipe > 0 && conn->rlen == 0)
+    redisAsyncRead(ac);
+
+  while (conn->ac != nullptr && !ac->c.err && conn->rlen > 0) {
+    auto c = &ac->c;
+
+    /* In place bulk strings and GETs to a descriptor are received through
+     * redisBufferRead(), everything else is fed straight from the provided
+     * buffer */
+    if (c->tofd.active || redisReaderBulkBuffer(c->reader, &bulkavail) != nullptr) {
+      /* A full descriptor takes nothing, not even from the pipe, and the
+       * write event that __redisAsyncGetReply() asked for tries again */
+      auto rlen = conn->rlen;
+      auto inpipe = c->tofd.inpipe;
+      redisAsyncRead(ac);
+      if (conn->ac != nullptr && conn->rlen == rlen && c->tofd.inpipe == inpipe)
+        return;
+      continue;
+    }
+
+    auto len = conn->rlen;
+    conn->rlen = 0;
+    if (redisReaderFeed(c->reader, conn->rbuf, len) != REDIS_OK) {
+      __redisSetError(c, c->reader->err, c->reader->errstr);
+      __redisAsyncDisconnect(ac);
+      return;
+    }
+    _EL_ADD_READ(ac);
+    redisProcessCallbacks(ac);
+  }
+
+  /* Report the end of the connection */
+  if (conn->ac != nullptr && conn->reof)
+    redisAsyncRead(ac);
+  /* Receive again once the held bytes are consumed */
+  else if (conn->ac != nullptr && conn->reading && !conn->recving && conn->rlen == 0)
+    redisUringMarkDirty(conn);
+}
+
+/* Not redisAsyncWrite() itself, so REDIS_OPT_INLINE_WRITE doesn't try to
+ * write before a send was submitted */
+static void redisUringAsyncWrite(redisAsyncContext *ac) {
+  redisAsyncWrite(ac);
+}
+
+static redisContextFuncs redisContextUringFuncs = {.close = redisNetClose,
+                                                   .free_privctx = nullptr,
+                                                   .async_read = redisUringAsyncRead,
+                                                   .async_write = redisUringAsyncWrite,
+                                                   .read = redisUringRead,
+                                                   .write = redisUringWrite};
+
+static void redisUringAddRead(void *data) {
+  redisUringConn *conn = data;
+  conn->reading = true;
+  if (!conn->recving)
+    redisUringMarkDirty(conn);
+}
+
+static void redisUringDelRead(void *data) {
+  redisUringConn *conn = data;
+  conn->reading = false;
+}
+
+static void redisUringAddWrite(void *data) {
+  redisUringConn *conn = data;
+  conn->writing = true;
+  if (!conn->sending)
+    redisUringMarkDirty(conn);
+}
+
+static void redisUringDelWrite(void *data) {
+  redisUringConn *conn = data;
+  conn->writing = false;
+}
+
+static void redisUringScheduleTimer(void *data, struct timeval tv) {
+  redisUringConn *conn = data;
+  conn->deadline = redisUringNow() + (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+static void redisUringCleanup(void *data) {
+  redisUringConn *conn = data;
+  auto ring = conn->ring;
+
+  conn->ac = nullptr;
+  conn->reading = conn->writing = false;
+  redisUringUnlink(&ring->conns, conn);
+  redisUringLink(&ring->dead, conn);
+
+  /* The connection is freed by the tick once these completed */
+  if (conn->recving)
+    redisUringCancel(&ring->q, redisUringData(conn, REDIS_URING_RECV));
+  if (conn->sending) {
+    /* Refs are released with the context: keep a send retried after this
+     * from putting their memory on the wire */
+    if (conn->sref)
+      shutdown(conn->fd, SHUT_WR);
+    redisUringCancel(&ring->q, redisUringData(conn, REDIS_URING_SEND));
+  }
+  if (conn->polling)
+    redisUringCancel(&ring->q, redisUringData(conn, REDIS_URING_POLL));
+}
+
+static void redisUringFreeConns(redisUringConn **list, bool all) {
+  redisUringConn *conn, *next;
+
+  for (conn = *list; conn != nullptr; conn = next) {
+    next = conn->next;
+    if (all || (conn->inflight == 0 && !conn->dirty)) {
+      redisUringUnlink(list, conn);
+      hi_free(conn->sbuf);
+      hi_free(conn->hbuf);
+      hi_free(conn);
+    }
+  }
+}
+
+redisUring *redisUringCreate(unsigned entries) {
+  constexpr unsigned min_entries = 16;
+  constexpr unsigned max_entries = 32'768;
+
+  if (entries < min_entries)
+    entries = min_entries;
+  if (entries > max_entries)
+    entries = max_entries;
+
+  redisUring *ring = hi_calloc(1, sizeof(*ring));
+  if (ring == nullptr) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  if (redisUringQueueInit(&ring->q, entries) != REDIS_OK) {
+    hi_free(ring);
+    return nullptr;
+  }
+
+  /* One provided buffer per SQE, the kernel rounded that to a power of two */
+  ring->nbufs = ring->q.sqentries;
+  ring->brsz = ring->nbufs * sizeof(struct io_uring_buf);
+  ring->br = mmap(nullptr, ring->brsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->br == MAP_FAILED) {
+    ring->br = nullptr;
+    goto error;
+  }
+  ring->bufs = hi_malloc((size_t)ring->nbufs * REDIS_URING_BUFSIZE);
+  if (ring->bufs == nullptr) {
+    errno = ENOMEM;
+    goto error;
+  }
+
+  /* Provided buffer rings need Linux 5.19 */
+  struct io_uring_buf_reg reg = {.ring_addr = (uint64_t)(uintptr_t)ring->br,
+                                 .ring_entries = ring->nbufs,
+                                 .bgid = REDIS_URING_BGID};
+  if (syscall(__NR_io_uring_register, ring->q.fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    goto error;
+  for (unsigned i = 0; i < ring->nbufs; i++)
+    redisUringRecycle(ring, i);
+
+  return ring;
+
+error:
+  redisUringQueueClose(&ring->q);
+  if (ring->br != nullptr)
+    munmap(ring->br, ring->brsz);
+  hi_free(ring->bufs);
+  hi_free(ring);
+  return nullptr;
+}
+
+void redisUringFree(redisUring *ring) {
+  struct io_uring_cqe cqe;
+
+  if (ring == nullptr)
+    return;
+
+  /* The kernel may still write to the buffers of operations in flight, wait
+   * for the cancellations the freed contexts queued */
+  while (ring->inflight > 0) {
+    auto ret = redisUringEnter(&ring->q, 1, 1.0);
+    if (ret < 0 && ret != -EINTR)
+      break;
+    while (redisUringCqe(&ring->q, &cqe))
+      redisUringComplete(ring, &cqe);
+  }
+
+  redisUringFreeConns(&ring->dead, true);
+  redisUringFreeConns(&ring->conns, true);
+  redisUringQueueClose(&ring->q);
+  munmap(ring->br, ring->brsz);
+  hi_free(ring->bufs);
+  hi_free(ring);
+}
+
+int redisUringAttach(redisAsyncContext *ac, redisUring *ring) {
+  auto c = &ac->c;
+
+  /* Nothing should be attached when something is already attached, and the
+   * context must not use another transport */
+  if (ac->ev.data != nullptr || c->privctx != nullptr || c->funcs->read != redisNetRead)
+    return REDIS_ERR;
+
+  redisUringConn *conn = hi_calloc(1, sizeof(*conn));
+  if (conn == nullptr)
+    return REDIS_ERR;
+  conn->ring = ring;
+  conn->ac = ac;
+  conn->fd = c->fd;
+  redisUringLink(&ring->conns, conn);
+
+  c->funcs = &redisContextUringFuncs;
+  c->privctx = conn;
+
+  /* Register functions to start/stop listening for events */
+  ac->ev.addRead = redisUringAddRead;
+  ac->ev.delRead = redisUringDelRead;
+  ac->ev.addWrite = redisUringAddWrite;
+  ac->ev.delWrite = redisUringDelWrite;
+  ac->ev.scheduleTimer = redisUringScheduleTimer;
+  ac->ev.cleanup = redisUringCleanup;
+  ac->ev.data = conn;
+
+  /* Commands queued before attaching */
+  if (redisOutputPending(c) > 0)
+    redisUringAddWrite(conn);
+
+  return REDIS_OK;
+}
+
+int redisUringTick(redisUring *ring, double timeout) {
+  struct io_uring_cqe cqe;
+  redisUringConn *conn;
+  auto handled = 0;
+
+  /* Queue the I/O asked for since the last tick. Contexts that become dirty
+   * while this runs are queued on the next one. */
+  auto dirty = ring->dirty;
+  ring->dirty = nullptr;
+  while ((conn = dirty) != nullptr) {
+    dirty = conn->dirtynext;
+    redisUringPrepare(conn);
+  }
+
+  /* Don't sleep past the nearest timeout */
+  auto now = redisUringNow();
+  for (conn = ring->conns; conn != nullptr; conn = conn->next) {
+    if (conn->deadline != 0.0 && (timeout < 0.0 || conn->deadline - now < timeout))
+      timeout = conn->deadline > now ? conn->deadline - now : 0.0;
+  }
+  if (ring->dirty != nullptr)
+    timeout = 0.0;
+
+  unsigned wait = (timeout == 0.0 || redisUringHasCqe(&ring->q)) ? 0 : 1;
+  if (wait > 0 && timeout < 0.0 && ring->inflight == 0 && redisUringQueued(&ring->q) == 0)
+    return 0;
+
+  auto ret = redisUringEnter(&ring->q, wait, timeout);
+  if (ret < 0 && ret != -ETIME && ret != -EINTR && ret != -EBUSY) {
+    errno = -ret;
+    return -1;
+  }
+
+  while (redisUringCqe(&ring->q, &cqe)) {
+    redisUringComplete(ring, &cqe);
+    handled++;
+  }
+
+  /* Perform timeouts. A callback may free any context, so the list is
+   * walked again after each one. */
+  now = redisUringNow();
+  for (;;) {
+    for (conn = ring->conns; conn != nullptr; conn = conn->next) {
+      if (conn->deadline != 0.0 && now >= conn->deadline)
+        break;
+    }
+    if (conn == nullptr)
+      break;
+    conn->deadline = 0.0;
+    redisAsyncHandleTimeout(conn->ac);
+    handled++;
+  }
+
+  redisUringFreeConns(&ring->dead, false);
+  return handled;
+}
+
+static double redisUringSyncTimeout(const redisContext *c) {
+  auto tv = c->command_timeout;
+  if (tv == nullptr || (tv->tv_sec == 0 && tv->tv_usec == 0))
+    return -1.0;
+  return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+static void redisUringSyncRecv(redisUringSync *s, int fd, uint8_t flags) {
+  auto sqe = redisUringSqe(&s->q, IORING_OP_RECV, fd, REDIS_URING_RECV);
+  sqe->addr = (uint64_t)(uintptr_t)s->buf;
+  sqe->len = sizeof(s->buf);
+  sqe->flags = flags;
+  s->recving = true;
+  s->received = false;
+  s->off = 0;
+}
+
+/* Reap the completions of a blocking context, setting *sendres when the send
+ * is among them. */
+static void redisUringSyncReap(redisUringSync *s, bool *sent, int *sendres) {
+  struct io_uring_cqe cqe;
+
+  while (redisUringCqe(&s->q, &cqe)) {
+    if (cqe.user_data == REDIS_URING_SEND) {
+      *sent = true;
+      *sendres = cqe.res;
+    } else if (cqe.user_data == REDIS_URING_RECV) {
+      /* A short send breaks the link, the recv is submitted again */
+      if (cqe.res == -ECANCELED) {
+        s->recving = false;
+      } else {
+        s->received = true;
+        s->res = cqe.res;
+      }
+    }
+  }
+}
+
+static ssize_t redisUringSyncRead(redisContext *c, char *buf, size_t bufcap) {
+  redisUringSync *s = c->privctx;
+  bool sent = false;
+  int sendres;
+
+  /* Reconnected without the ring */
+  if (s == nullptr)
+    return redisNetRead(c, buf, bufcap);
+
+  auto timeout = redisUringSyncTimeout(c);
+  for (;;) {
+    if (!s->recving)
+      redisUringSyncRecv(s, c->fd, 0);
+    if (s->received)
+      break;
+
+    auto ret = redisUringEnter(&s->q, 1, timeout);
+    redisUringSyncReap(s, &sent, &sendres);
+    if (s->received || ret == -EINTR)
+      continue;
+    if (ret == -ETIME) {
+      /* The recv stays armed, it is cancelled when the context is freed */
+      __redisSetError(c, REDIS_ERR_TIMEOUT, "recv timeout");
+      return -1;
+    } else if (ret < 0) {
+      __redisSetError(c, REDIS_ERR_IO, strerror(-ret));
+      return -1;
+    }
+  }
+
+  if (s->res <= 0) {
+    s->recving = false;
+    if (s->res == -EINTR || s->res == -EAGAIN)
+      return 0;
+    if (s->res == 0)
+      __redisSetError(c, REDIS_ERR_EOF, "Server closed the connection");
+    else
+      __redisSetError(c, REDIS_ERR_IO, strerror(-s->res));
+    return -1;
+  }
+
+  auto n = (size_t)s->res - s->off;
+  if (n > bufcap)
+    n = bufcap;
+  memcpy(buf, s->buf + s->off, n);
+  s->off += n;
+  if (s->off == (size_t)s->res)
+    s->recving = false;
+  return (ssize_t)n;
+}
+
+static ssize_t redisUringSyncWrite(redisContext *c) {
+  redisUringSync *s = c->privctx;
+  struct iovec iov[REDIS_IOV_MAX];
+  bool sent = false, timedout = false;
+  int sendres = 0;
+
+  if (s == nullptr)
+    return redisNetWrite(c);
+
+  /* File refs are sent with sendfile() */
+  auto iovcnt = redisOutputIov(c, iov, REDIS_IOV_MAX);
+  if (iovcnt == 0)
+    return redisNetWrite(c);
+
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)iovcnt};
+  auto sqe = redisUringSqe(&s->q, IORING_OP_SENDMSG, c->fd, REDIS_URING_SEND);
+  sqe->addr = (uint64_t)(uintptr_t)&msg;
+  sqe->len = 1;
+
+  /* Link the recv for the reply, so it is armed by the same io_uring_enter()
+   * as soon as the command went out. Only the send is waited for, the recv
+   * is collected by redisUringSyncRead(). */
+  if (!s->recving) {
+    sqe->flags = IOSQE_IO_LINK;
+    redisUringSyncRecv(s, c->fd, 0);
+  }
+
+  auto timeout = redisUringSyncTimeout(c);
+  while (!sent) {
+    auto ret = redisUringEnter(&s->q, 1, timeout);
+    redisUringSyncReap(s, &sent, &sendres);
+    if (sent || ret == -EINTR)
+      continue;
+    if (ret == -ETIME && !timedout) {
+      /* msg and the output must outlive the send */
+      redisUringCancel(&s->q, REDIS_URING_SEND);
+      timedout = true;
+      timeout = -1.0;
+    } else if (ret < 0) {
+      __redisSetError(c, REDIS_ERR_IO, strerror(-ret));
+      return -1;
+    }
+  }
+
+  if (sendres >= 0)
+    return sendres;
+  if (sendres == -EINTR || sendres == -EAGAIN)
+    return 0;
+  if (sendres == -ECANCELED && timedout)
+    __redisSetError(c, REDIS_ERR_TIMEOUT, "send timeout");
+  else
+    __redisSetError(c, REDIS_ERR_IO, strerror(-sendres));
+  return -1;
+}
+
+static void redisUringSyncFree(void *privctx) {
+  redisUringSync *s = privctx;
+  bool sent = false;
+  int sendres;
+
+  if (s == nullptr)
+    return;
+
+  /* The kernel writes to buf until the recv completed */
+  if (s->recving && !s->received) {
+    redisUringCancel(&s->q, REDIS_URING_RECV);
+    while (s->recving && !s->received) {
+      auto ret = redisUringEnter(&s->q, 1, 1.0);
+      redisUringSyncReap(s, &sent, &sendres);
+      if (ret < 0 && ret != -EINTR)
+        break;
+    }
+  }
+  redisUringQueueClose(&s->q);
+  hi_free(s);
+}
+
+static redisContextFuncs redisContextUringSyncFuncs = {.close = redisNetClose,
+                                                       .free_privctx = redisUringSyncFree,
+                                                       .async_read = redisAsyncRead,
+                                                       .async_write = redisAsyncWrite,
+                                                       .read = redisUringSyncRead,
+                                                       .write = redisUringSyncWrite};
+
+int redisInitiateUring(redisContext *c) {
+  if (!(c->flags & REDIS_BLOCK) || !(c->flags & REDIS_CONNECTED) || c->privctx != nullptr ||
+      c->funcs->read != redisNetRead) {
+    errno = EINVAL;
+    return REDIS_ERR;
+  }
+
+  redisUringSync *s = hi_malloc(sizeof(*s));
+  if (s == nullptr) {
+    errno = ENOMEM;
+    return REDIS_ERR;
+  }
+  if (redisUringQueueInit(&s->q, REDIS_URING_SYNC_ENTRIES) != REDIS_OK) {
+    hi_free(s);
+    return REDIS_ERR;
+  }
+  s->recving = s->received = false;
+  s->res = 0;
+  s->off = 0;
+
+  c->funcs = &redisContextUringSyncFuncs;
+  c->privctx = s;
+  return REDIS_OK;
+}
+
+#else
+
+redisUring *redisUringCreate(unsigned entries) {
+  (void)entries;
+  errno = ENOSYS;
+  return nullptr;
+}
+
+void redisUringFree(redisUring *ring) {
+  (void)ring;
+}
+
+int redisUringAttach(redisAsyncContext *ac, redisUring *ring) {
+  (void)ac;
+  (void)ring;
+  return REDIS_ERR;
+}
+
+int redisUringTick(redisUring *ring, double timeout) {
+  (void)ring;
+  (void)timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+int redisInitiateUring(redisContext *c) {
+  (void)c;
+  errno = ENOSYS;
+  return REDIS_ERR;
+}
+
+#endif